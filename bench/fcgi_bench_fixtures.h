@@ -0,0 +1,108 @@
+#ifndef FCGI_BENCH_FIXTURES_H_
+#define FCGI_BENCH_FIXTURES_H_
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "fcgi_protocol.h"
+
+// What nginx sends for a typical browser GET with the stock fastcgi_params.
+inline std::vector<std::pair<std::string, std::string>> NginxParams() {
+  return {
+      {"QUERY_STRING", "id=1024&sort=desc&page=3"},
+      {"REQUEST_METHOD", "GET"},
+      {"CONTENT_TYPE", ""},
+      {"CONTENT_LENGTH", ""},
+      {"SCRIPT_NAME", "/api/v1/items"},
+      {"REQUEST_URI", "/api/v1/items?id=1024&sort=desc&page=3"},
+      {"DOCUMENT_URI", "/api/v1/items"},
+      {"DOCUMENT_ROOT", "/usr/share/nginx/html"},
+      {"SERVER_PROTOCOL", "HTTP/1.1"},
+      {"REQUEST_SCHEME", "https"},
+      {"HTTPS", "on"},
+      {"GATEWAY_INTERFACE", "CGI/1.1"},
+      {"SERVER_SOFTWARE", "nginx/1.24.0"},
+      {"REMOTE_ADDR", "203.0.113.54"},
+      {"REMOTE_PORT", "53122"},
+      {"SERVER_ADDR", "10.0.3.17"},
+      {"SERVER_PORT", "443"},
+      {"SERVER_NAME", "www.example.com"},
+      {"REDIRECT_STATUS", "200"},
+      {"HTTP_HOST", "www.example.com"},
+      {"HTTP_CONNECTION", "keep-alive"},
+      {"HTTP_USER_AGENT",
+       "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like "
+       "Gecko) Chrome/118.0.0.0 Safari/537.36"},
+      {"HTTP_ACCEPT",
+       "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,"
+       "image/webp,*/*;q=0.8"},
+      {"HTTP_ACCEPT_ENCODING", "gzip, deflate, br"},
+      {"HTTP_ACCEPT_LANGUAGE", "en-US,en;q=0.9,de;q=0.8"},
+      {"HTTP_COOKIE",
+       "session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; "
+       "_ga=GA1.2.1234567890.1697040000; consent=1; "
+       "csrftoken=bb1f6f1e7cd340cbbf1a1d1e1f1a2b3c4d5e6f708192a3b4c5d6e7f8"
+       "091a2b3c4d5e6f7a8b9c0d1e2f3a4b5c6d7e8f9a0b1c2d3e4f5a6b7c8d9e0f1a2b"
+       "3c4d5e6f7a8b9c0d1e2f3a4b5c6d7e8f9a0b"},
+      {"HTTP_REFERER", "https://www.example.com/items?page=2"},
+      {"HTTP_X_FORWARDED_FOR", "198.51.100.7, 203.0.113.54"},
+  };
+}
+
+inline void AppendLength(std::string &out, size_t len) {
+  if (len < 0x80) {
+    out += char(len);
+  } else {
+    out += char(((len >> 24) & 0x7f) | 0x80);
+    out += char((len >> 16) & 0xff);
+    out += char((len >> 8) & 0xff);
+    out += char(len & 0xff);
+  }
+}
+
+inline void AppendRecord(std::string &out, int type, int request_id,
+                         const std::string &content) {
+  const int padding = (8 - content.size() % 8) % 8;
+  const unsigned char head[FCGI_HEADER_LEN] = {
+      FCGI_VERSION_1,
+      (unsigned char)type,
+      (unsigned char)(request_id >> 8),
+      (unsigned char)request_id,
+      (unsigned char)(content.size() >> 8),
+      (unsigned char)content.size(),
+      (unsigned char)padding,
+      0};
+  out.append((const char *)head, sizeof(head));
+  out += content;
+  out.append(padding, '\0');
+}
+
+inline std::string ParamsContent(
+    const std::vector<std::pair<std::string, std::string>> &params) {
+  std::string content;
+  for (auto &p : params) {
+    AppendLength(content, p.first.size());
+    AppendLength(content, p.second.size());
+    content += p.first;
+    content += p.second;
+  }
+  return content;
+}
+
+// The records nginx writes for one request, body split into STDIN records.
+inline std::string RequestRecords(int request_id, const std::string &body,
+                                  bool keep_conn = true) {
+  std::string out;
+  const char flags = keep_conn ? FCGI_KEEP_CONN : 0;
+  const char begin[8] = {0, FCGI_RESPONDER, flags};
+  AppendRecord(out, FCGI_BEGIN_REQUEST, request_id, std::string(begin, 8));
+  AppendRecord(out, FCGI_PARAMS, request_id, ParamsContent(NginxParams()));
+  AppendRecord(out, FCGI_PARAMS, request_id, "");
+  for (size_t i = 0; i < body.size(); i += 65535)
+    AppendRecord(out, FCGI_STDIN, request_id, body.substr(i, 65535));
+  AppendRecord(out, FCGI_STDIN, request_id, "");
+  return out;
+}
+
+#endif
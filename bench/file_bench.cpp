@@ -0,0 +1,132 @@
+// Compares FcgiRequest::stdout_file() with reading the file and sending it
+// through the copying stdout(), over a Unix socket to a client thread.
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include "fcgi_app.h"
+#include "fcgi_bench_fixtures.h"
+#include "fcgi_request.h"
+
+static int s_fd = -1;
+static size_t s_file_len = 0;
+
+static bool SendCopy(FcgiRequest &req) {
+  std::string body(s_file_len, '\0');
+  if (pread(s_fd, &body[0], s_file_len, 0) != ssize_t(s_file_len))
+    return false;
+  return req.stdout(body);
+}
+
+static bool SendFile(FcgiRequest &req) {
+  return req.stdout_file(s_fd, 0, s_file_len);
+}
+
+static double CpuSeconds() {
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  auto sec = [](const timeval &tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+  return sec(ru.ru_utime) + sec(ru.ru_stime);
+}
+
+// Reads one response, returning its STDOUT length, or -1 on a broken stream.
+static long ReadResponse(int sock, std::string &buf) {
+  long stdout_len = 0;
+  size_t idx = 0;
+  auto complete = [&buf, &idx] {
+    if (buf.size() - idx < FCGI_HEADER_LEN) return false;
+    const unsigned char *h = (const unsigned char *)&buf[idx];
+    return size_t(FCGI_HEADER_LEN + ((h[4] << 8) | h[5]) + h[6]) <=
+           buf.size() - idx;
+  };
+
+  for (;;) {
+    while (!complete()) {
+      char chunk[1024 * 64];
+      const ssize_t n = read(sock, chunk, sizeof(chunk));
+      if (n <= 0) return -1;
+      buf.append(chunk, n);
+    }
+
+    const unsigned char *h = (const unsigned char *)&buf[idx];
+    const int content_len = (h[4] << 8) | h[5];
+    idx += FCGI_HEADER_LEN + content_len + h[6];
+    if (h[1] == FCGI_STDOUT) stdout_len += content_len;
+    if (h[1] == FCGI_END_REQUEST) break;
+  }
+  buf.erase(0, idx);
+  return stdout_len;
+}
+
+template <typename F>
+static void Run(const char *name, const std::string &path, int requests,
+                F send) {
+  FcgiApp::new_instance();
+  FcgiApp::instance()->listen_unix(path);
+  FcgiApp::instance()->set_request_handler([send](FcgiRequest &req) {
+    if (send(req)) req.end_stdout();
+    req.reply(0);
+    return true;
+  });
+  FcgiApp::instance()->start(1);
+
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+  const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  while (connect(sock, (sockaddr *)&addr, sizeof(addr)) != 0)
+    std::this_thread::yield();
+
+  const std::string request = RequestRecords(1, "");
+  std::string buf;
+  long bytes = 0;
+  const double cpu0 = CpuSeconds();
+  const auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < requests; ++i) {
+    if (write(sock, request.data(), request.size()) != ssize_t(request.size()))
+      break;
+    const long n = ReadResponse(sock, buf);
+    if (n != long(s_file_len)) {
+      printf("%s: short response of %ld bytes\n", name, n);
+      break;
+    }
+    bytes += n;
+  }
+  const auto t1 = std::chrono::steady_clock::now();
+  const double cpu1 = CpuSeconds();
+  close(sock);
+  FcgiApp::delete_instance();
+
+  const double sec = std::chrono::duration<double>(t1 - t0).count();
+  printf("%-8s %8.1f MB/s %8.1f us/request %6.2f cpu s/GB\n", name,
+         bytes / sec / 1e6, sec * 1e6 / requests, (cpu1 - cpu0) * 1e9 / bytes);
+}
+
+int main(int argc, char **argv) {
+  const long file_len = 1 < argc ? atol(argv[1]) : 1024 * 1024 * 4;
+  const int requests = 2 < argc ? atoi(argv[2]) : 500;
+
+  char file_path[] = "/tmp/fcgi_file_bench.XXXXXX";
+  s_fd = mkstemp(file_path);
+  unlink(file_path);
+  std::string data(file_len, '\0');
+  for (long i = 0; i < file_len; ++i) data[i] = char(i * 131);
+  if (write(s_fd, data.data(), data.size()) != ssize_t(data.size())) return 1;
+  s_file_len = file_len;
+  printf("file: %ld bytes, %d requests\n", file_len, requests);
+
+  const std::string sock_path =
+      "/tmp/fcgi_file_bench." + std::to_string(getpid()) + ".sock";
+  Run("copy", sock_path, requests, SendCopy);
+  Run("sendfile", sock_path, requests, SendFile);
+  unlink(sock_path.c_str());
+  close(s_fd);
+  return 0;
+}
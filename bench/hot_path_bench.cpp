@@ -0,0 +1,266 @@
+// Microbenchmarks of the per-request hot paths: record and params decoding
+// in FcgiRecordReader, stdout framing in FcgiRecordWriter, request assembly
+// in FcgiRequest and the FcgiRequestQueue between io and worker threads.
+//
+// Every case reports ns/op, MB/s of the records or body it moves, if any, and
+// heap allocations per op, counted by replacing the global operator new.
+// Pass a substring to run only the matching cases and the minimum run time
+// per case in milliseconds, e.g. "hot_path_bench writer 500".
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fcgi_bench_fixtures.h"
+#include "fcgi_queue.h"
+#include "fcgi_record.h"
+#include "fcgi_request.h"
+using namespace boost::asio;
+
+static std::atomic_long s_alloc_num(0);
+static std::atomic_long s_alloc_bytes(0);
+
+void *operator new(size_t size) {
+  s_alloc_num.fetch_add(1, std::memory_order_relaxed);
+  s_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static std::string s_filter;
+static double s_min_ns = 200e6;
+
+static void Report(const std::string &name, double ns, long ops, long bytes,
+                   long allocs, long alloc_bytes) {
+  printf("%-36s %10.1f ns/op", name.c_str(), ns / ops);
+  if (0 < bytes) {
+    printf(" %9.1f MB/s", double(bytes) * ops / ns * 1e3);
+  } else {
+    printf(" %14s", "");
+  }
+  printf(" %8.2f allocs/op %9.0f B/op\n", double(allocs) / ops,
+         double(alloc_bytes) / ops);
+}
+
+// Runs op, moving bytes each, for at least s_min_ns after a warm-up run
+// that lets the pools fill.
+template <typename F>
+static void Run(const std::string &name, long bytes, F op) {
+  if (name.find(s_filter) == std::string::npos) return;
+
+  op();
+  for (long iterations = 1;; iterations *= 2) {
+    const long allocs = s_alloc_num.load();
+    const long alloc_bytes = s_alloc_bytes.load();
+    const auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) op();
+    const auto t1 = std::chrono::steady_clock::now();
+    const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    if (s_min_ns <= ns || (1L << 40) <= iterations) {
+      Report(name, ns, iterations, bytes, s_alloc_num.load() - allocs,
+             s_alloc_bytes.load() - alloc_bytes);
+      return;
+    }
+  }
+}
+
+// Hands data to reader the way socket reads would, a free space's worth at
+// a time, calling f on every complete record.
+template <typename F>
+static void Feed(FcgiRecordReader &reader, const std::string &data, F f) {
+  size_t off = 0;
+  while (off < data.size()) {
+    if (reader.buf_full() && !reader.grow()) abort();
+    auto buf = reader.buf();
+    const size_t n = std::min(buffer_size(buf), data.size() - off);
+    memcpy(buffer_cast<char *>(buf), data.data() + off, n);
+    off += n;
+    reader.transferred(n);
+
+    reader.scan();
+    for (; reader.can_read(); reader.next_record()) f(reader);
+    reader.clear_complete_record();
+  }
+}
+
+static void ReaderBenches() {
+  FcgiRecordReader reader;
+  ParamsVector vec;
+
+  std::string batch;
+  for (int i = 0; i < 32; ++i) batch += RequestRecords(1, "");
+  Run("reader/params_32_requests", batch.size(), [&] {
+    Feed(reader, batch, [&](FcgiRecordReader &r) {
+      if (r.type() != FCGI_PARAMS) return;
+      vec.clear();
+      r.params(vec);
+    });
+  });
+
+  for (size_t len : {1024, 64 * 1024, 4 * 1024 * 1024}) {
+    const std::string records = RequestRecords(1, std::string(len, 'x'));
+    Run("reader/stdin_" + std::to_string(len / 1024) + "k", len, [&] {
+      long stdin_len = 0;
+      Feed(reader, records, [&](FcgiRecordReader &r) {
+        if (r.type() == FCGI_STDIN) stdin_len += r.content_length();
+      });
+      if (stdin_len != long(len)) abort();
+    });
+  }
+}
+
+// Sends whatever the writer holds, as a write of everything would.
+static void Drain(FcgiRecordWriter &writer) {
+  std::vector<FcgiWriteCallback> finished;
+  while (!writer.buf_empty()) {
+    long len = 0;
+    for (auto &b : writer.buf()) len += b.size();
+    writer.transferred(len, finished);
+    finished.clear();
+  }
+}
+
+static void WriterBenches() {
+  FcgiRecordWriter writer;
+
+  // body length and the chunks a handler writes it in
+  const std::pair<size_t, size_t> patterns[] = {
+      {1024, 1024},
+      {64 * 1024, 64 * 1024},
+      {64 * 1024, 4 * 1024},
+      {64 * 1024, 256},
+      {4 * 1024 * 1024, 64 * 1024},
+  };
+  for (auto &p : patterns) {
+    const std::string body(p.first, 'x');
+    const std::string name = "writer/stdout_" + std::to_string(p.first / 1024) +
+                             "k_by_" + std::to_string(p.second);
+    Run(name, p.first, [&] {
+      for (size_t off = 0; off < body.size(); off += p.second) {
+        const_buffers_1 chunk(body.data() + off, p.second);
+        writer.stdout(1, chunk);
+      }
+      writer.end_stdout(1);
+      writer.reply(1, 0);
+      Drain(writer);
+    });
+  }
+
+  // handed over without copying, as FcgiRequest::stdout(std::string &&) does
+  auto owned = std::make_shared<const std::string>(64 * 1024, 'x');
+  Run("writer/stdout_64k_zero_copy", owned->size(), [&] {
+    writer.stdout(1, const_buffer(owned->data(), owned->size()), owned,
+                  nullptr);
+    writer.end_stdout(1);
+    writer.reply(1, 0);
+    Drain(writer);
+  });
+}
+
+static void RequestBenches() {
+  auto pool = FcgiObjectPool<FcgiRequest>::instance();
+
+  for (size_t len : {0, 1024, 64 * 1024, 4 * 1024 * 1024}) {
+    auto params = NginxParams();
+    for (auto &p : params) {
+      if (p.first == "CONTENT_LENGTH") p.second = std::to_string(len);
+    }
+    const std::string content = ParamsContent(params);
+    ParamsVector vec;
+    FcgiRecordReader::decode_params(content.data(), content.size(), vec);
+    const std::string body(len, 'x');
+
+    Run("request/assemble_" + std::to_string(len / 1024) + "k", len, [&] {
+      FcgiRequest *req = FcgiRequest::create();
+      req->set_request_id(1);
+      req->set_role(FCGI_RESPONDER);
+      req->add_params(vec);
+      for (size_t off = 0; off < body.size(); off += 65535) {
+        const size_t n = std::min<size_t>(65535, body.size() - off);
+        req->add_stdin_data(const_buffer(body.data() + off, n));
+      }
+      if (!req->known(CgiVar::RequestUri) || !req->param("HTTP_COOKIE"))
+        abort();
+      pool->release(req);
+    });
+  }
+}
+
+// Half of the threads push, the others pop, the way io threads and workers
+// share FcgiApp's queue; a single thread does both in turn.
+static void QueueBench(int thread_num) {
+  const std::string name = "queue/push_pop_" + std::to_string(thread_num) +
+                           (thread_num == 1 ? "_thread" : "_threads");
+  if (name.find(s_filter) == std::string::npos) return;
+
+  FcgiRequestQueue queue(1024 * 64);
+  // only compared with nullptr, never dereferenced
+  FcgiRequest *req = reinterpret_cast<FcgiRequest *>(&queue);
+  const long total = 1L << 20;
+  const long allocs = s_alloc_num.load();
+  const long alloc_bytes = s_alloc_bytes.load();
+  const auto t0 = std::chrono::steady_clock::now();
+
+  if (thread_num == 1) {
+    for (long i = 0; i < total; ++i) {
+      queue.try_push(req);
+      queue.try_pop();
+    }
+  } else {
+    const int producer_num = thread_num / 2;
+    std::atomic_long popped(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_num; ++i) {
+      if (i < producer_num) {
+        const long n = total / producer_num + (i < total % producer_num);
+        threads.emplace_back([&queue, req, n] {
+          for (long j = 0; j < n;) {
+            if (queue.try_push(req)) {
+              ++j;
+            } else {
+              std::this_thread::yield();
+            }
+          }
+        });
+      } else {
+        threads.emplace_back([&queue, &popped, total] {
+          while (popped.load(std::memory_order_relaxed) < total) {
+            if (queue.try_pop() != nullptr) {
+              popped.fetch_add(1, std::memory_order_relaxed);
+            } else {
+              std::this_thread::yield();
+            }
+          }
+        });
+      }
+    }
+    for (auto &t : threads) t.join();
+  }
+
+  const auto t1 = std::chrono::steady_clock::now();
+  Report(name, std::chrono::duration<double, std::nano>(t1 - t0).count(),
+         total, 0, s_alloc_num.load() - allocs,
+         s_alloc_bytes.load() - alloc_bytes);
+}
+
+int main(int argc, char **argv) {
+  if (1 < argc) s_filter = argv[1];
+  if (2 < argc) s_min_ns = atof(argv[2]) * 1e6;
+
+  ReaderBenches();
+  WriterBenches();
+  RequestBenches();
+  for (int thread_num = 1; thread_num <= 64; thread_num *= 2)
+    QueueBench(thread_num);
+  return 0;
+}
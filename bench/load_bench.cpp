@@ -0,0 +1,508 @@
+// Loopback FastCGI load generator.  Drives either an in-process FcgiApp
+// (--serve) or an external server such as example/demo over TCP or a Unix
+// socket, and reports throughput and latency percentiles.
+//
+// With --rate requests follow a fixed open-loop schedule, and latency is
+// measured from when a request was due rather than from when its connection
+// got around to sending it.  A stalled server therefore shows up in the
+// percentiles instead of slowing the load down (no coordinated omission).
+// Without --rate every connection keeps --depth requests in flight back to
+// back.
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fcgi_app.h"
+#include "fcgi_bench_fixtures.h"
+#include "fcgi_metrics.h"
+#include "fcgi_request.h"
+
+static const char *const s_usage =
+    "usage: load_bench (--port PORT | --unix PATH) [options]\n"
+    "  --threads N         client threads (2)\n"
+    "  --connections N     connections, spread over the threads (16)\n"
+    "  --depth N           requests in flight per connection (1)\n"
+    "  --no-keep-alive     a new connection per request, depth 1\n"
+    "  --rate N            requests per second in total, open loop\n"
+    "                      (0: closed loop)\n"
+    "  --duration S        seconds to run (5)\n"
+    "  --request-size N    body bytes per request (0)\n"
+    "  --response-size N   body bytes per response of --serve (1024)\n"
+    "  --serve N           start an FcgiApp with N io threads on the address\n"
+    "  --dispatch MODE     inline, queue or stream, for --serve (inline)\n"
+    "  --workers N         threads popping the queue of --serve (1)\n"
+    "  --sharded           FcgiApp::set_sharded(), for --serve\n"
+    "  --io-uring          FcgiApp::set_io_uring(), for --serve\n";
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 0;
+  std::string unix_path;
+  int threads = 2;
+  int connections = 16;
+  int depth = 1;
+  bool keep_conn = true;
+  double rate = 0;
+  double duration = 5;
+  size_t request_size = 0;
+  size_t response_size = 1024;
+  int serve = 0;
+  std::string dispatch = "inline";
+  int workers = 1;
+  bool sharded = false;
+  bool io_uring = false;
+};
+
+static long NowNs() { return FcgiMetrics::now_ns(); }
+
+// Waits up to timeout_ns, to the nanosecond where epoll_pwait2() is there.
+// Otherwise the timeout is rounded up to milliseconds, which makes requests
+// up to 1 ms late rather than spinning on the cpu the server may need.
+static int Wait(int epoll, epoll_event *events, int n, long timeout_ns) {
+#if defined(__GLIBC__) && (2 < __GLIBC__ || 35 <= __GLIBC_MINOR__)
+  const timespec ts = {timeout_ns / 1000000000, timeout_ns % 1000000000};
+  const int rc = epoll_pwait2(epoll, events, n, &ts, nullptr);
+  if (rc != -1 || errno != ENOSYS) return rc;
+#endif
+  return epoll_wait(epoll, events, n, int((timeout_ns + 999999) / 1000000));
+}
+
+////////////////////////////////////////////////////////////////////////////
+// in-process server
+
+static std::shared_ptr<const std::string> s_response;
+
+static void Respond(FcgiRequest &req) {
+  req.stdout(s_response);
+  req.end_stdout();
+  req.reply(0);
+}
+
+static void Worker() {
+  for (;;) {
+    FcgiRequest *req = FcgiApp::instance()->pop_request_blocking();
+    // pushed by StopServer()
+    if (req->request_id() == 0) {
+      FcgiObjectPool<FcgiRequest>::instance()->release(req);
+      return;
+    }
+    Respond(*req);
+    FcgiApp::instance()->free_request(req);
+  }
+}
+
+static bool StartServer(const Options &opts,
+                        std::vector<std::thread> &workers) {
+  auto response = std::make_shared<std::string>(
+      "Content-type: application/octet-stream\r\n\r\n");
+  response->append(opts.response_size, 'x');
+  s_response = response;
+
+  FcgiApp::new_instance();
+  auto app = FcgiApp::instance();
+  app->set_sharded(opts.sharded);
+  app->set_io_uring(opts.io_uring);
+  if (opts.dispatch == "inline") {
+    app->set_request_handler([](FcgiRequest &req) {
+      Respond(req);
+      return true;
+    });
+  } else if (opts.dispatch == "stream") {
+    app->set_stdin_streaming(true);
+    app->set_async_request_handler([](FcgiRequest *req) {
+      req->on_stdin([req](const boost::asio::const_buffer &, bool end) {
+        if (!end) return;
+        Respond(*req);
+        FcgiApp::instance()->free_request(req);
+      });
+    });
+  } else if (opts.dispatch == "queue") {
+    for (int i = 0; i < opts.workers; ++i) workers.emplace_back(Worker);
+  } else {
+    return false;
+  }
+
+  if (opts.unix_path.empty()) {
+    FcgiListenOptions listen_options;
+    listen_options.tcp_nodelay = true;
+    app->listen(opts.host, opts.port, listen_options);
+  } else {
+    app->listen_unix(opts.unix_path);
+  }
+  app->start(opts.serve);
+  return true;
+}
+
+static void StopServer(std::vector<std::thread> &workers) {
+  for (size_t i = 0; i < workers.size(); ++i) {
+    auto req = FcgiRequest::create();
+    while (!FcgiApp::instance()->push_request(req)) std::this_thread::yield();
+  }
+  for (auto &t : workers) t.join();
+  FcgiApp::delete_instance();
+}
+
+////////////////////////////////////////////////////////////////////////////
+// client
+
+struct Totals {
+  std::atomic_long _completed{0};
+  std::atomic_long _errors{0};
+  std::atomic_long _unfinished{0};
+  std::atomic_long _bytes{0};
+  FcgiHistogram _latency;
+};
+
+class Client {
+ public:
+  Client(const Options &opts, const std::vector<std::string> &requests,
+         int connection_num, long start, long end, Totals &totals)
+      : _opts(opts),
+        _requests(requests),
+        _end(end),
+        _totals(totals),
+        _completed(0),
+        _errors(0),
+        _bytes(0),
+        _epoll(epoll_create1(EPOLL_CLOEXEC)),
+        _conns(connection_num) {
+    // each connection gets an even share of the rate, staggered
+    if (0 < opts.rate) _interval = long(1e9 * opts.connections / opts.rate);
+    for (int i = 0; i < connection_num; ++i) {
+      _conns[i]._next_due = start + (_interval * i) / connection_num;
+      _conns[i]._due.resize(opts.depth + 1);
+      for (int id = opts.depth; 0 < id; --id) _conns[i]._free_ids.push_back(id);
+    }
+  }
+
+  ~Client() {
+    for (auto &c : _conns) {
+      if (0 <= c._fd) ::close(c._fd);
+    }
+    ::close(_epoll);
+  }
+
+  void run() {
+    epoll_event events[64];
+    for (long now = NowNs(); now < _end; now = NowNs()) {
+      long wake_at = _end;
+      for (size_t i = 0; i < _conns.size(); ++i) {
+        Conn &c = _conns[i];
+        schedule(c, now);
+        send(c, i);
+        // a connection with a backlog waits for a response instead
+        if (0 < _interval && c._backlog.empty() && c._next_due < wake_at)
+          wake_at = c._next_due;
+      }
+
+      const int n =
+          Wait(_epoll, events, 64, std::max(0L, wake_at - NowNs()));
+      for (int i = 0; i < n; ++i) {
+        Conn &c = _conns[events[i].data.u32];
+        if ((events[i].events & EPOLLOUT) && 0 <= c._fd) flush(c);
+        if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && 0 <= c._fd)
+          receive(c);
+      }
+    }
+
+    long unfinished = 0;
+    for (auto &c : _conns) {
+      unfinished += _opts.depth - c._free_ids.size() + c._backlog.size();
+    }
+    _totals._completed += _completed;
+    _totals._errors += _errors;
+    _totals._unfinished += unfinished;
+    _totals._bytes += _bytes;
+  }
+
+ private:
+  struct Conn {
+    int _fd = -1;
+    bool _want_out = false;
+    std::string _out;
+    size_t _out_idx = 0;
+    std::string _in;
+    // when each request in flight was due, by request id
+    std::vector<long> _due;
+    std::vector<int> _free_ids;
+    // open loop: next due time and requests due but not sent yet
+    long _next_due = 0;
+    std::deque<long> _backlog;
+  };
+
+  void schedule(Conn &c, long now) {
+    if (_interval == 0) {
+      while (now < _end && c._backlog.size() < c._free_ids.size())
+        c._backlog.push_back(now);
+      return;
+    }
+    for (; c._next_due <= now && c._next_due < _end; c._next_due += _interval)
+      c._backlog.push_back(c._next_due);
+  }
+
+  void send(Conn &c, size_t idx) {
+    bool queued = false;
+    while (!c._backlog.empty() && !c._free_ids.empty()) {
+      if (c._fd < 0 && !connect(c, idx)) {
+        _errors += c._backlog.size();
+        c._backlog.clear();
+        break;
+      }
+      const int id = c._free_ids.back();
+      c._free_ids.pop_back();
+      c._due[id] = c._backlog.front();
+      c._backlog.pop_front();
+      c._out += _requests[id - 1];
+      queued = true;
+      if (!_opts.keep_conn) break;
+    }
+    if (queued) flush(c);
+  }
+
+  bool connect(Conn &c, size_t idx) {
+    if (_opts.unix_path.empty()) {
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(_opts.port);
+      inet_pton(AF_INET, _opts.host.c_str(), &addr.sin_addr);
+      c._fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (::connect(c._fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+        return disconnect(c);
+      const int on = 1;
+      setsockopt(c._fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    } else {
+      sockaddr_un addr = {};
+      addr.sun_family = AF_UNIX;
+      strncpy(addr.sun_path, _opts.unix_path.c_str(),
+              sizeof(addr.sun_path) - 1);
+      c._fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (::connect(c._fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+        return disconnect(c);
+    }
+    fcntl(c._fd, F_SETFL, fcntl(c._fd, F_GETFL) | O_NONBLOCK);
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = idx;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, c._fd, &ev);
+    c._want_out = false;
+    return true;
+  }
+
+  // Closes the socket, counting what it had in flight as failed.
+  bool disconnect(Conn &c) {
+    if (0 <= c._fd) ::close(c._fd);
+    c._fd = -1;
+    c._out.clear();
+    c._out_idx = 0;
+    c._in.clear();
+    _errors += _opts.depth - c._free_ids.size();
+    c._free_ids.clear();
+    for (int id = _opts.depth; 0 < id; --id) c._free_ids.push_back(id);
+    return false;
+  }
+
+  void flush(Conn &c) {
+    while (c._out_idx < c._out.size()) {
+      const ssize_t n = ::send(c._fd, c._out.data() + c._out_idx,
+                               c._out.size() - c._out_idx, MSG_NOSIGNAL);
+      if (n < 0 && errno == EAGAIN) break;
+      if (n <= 0) {
+        disconnect(c);
+        return;
+      }
+      c._out_idx += n;
+    }
+    if (c._out_idx == c._out.size()) {
+      c._out.clear();
+      c._out_idx = 0;
+    }
+
+    const bool want_out = !c._out.empty();
+    if (want_out != c._want_out) {
+      epoll_event ev = {};
+      ev.events = want_out ? uint32_t(EPOLLIN | EPOLLOUT) : uint32_t(EPOLLIN);
+      ev.data.u32 = &c - &_conns[0];
+      epoll_ctl(_epoll, EPOLL_CTL_MOD, c._fd, &ev);
+      c._want_out = want_out;
+    }
+  }
+
+  void receive(Conn &c) {
+    char buf[64 * 1024];
+    bool closed = false;
+    for (;;) {
+      const ssize_t n = ::recv(c._fd, buf, sizeof(buf), 0);
+      if (n < 0 && errno == EAGAIN) break;
+      if (n <= 0) {
+        // what arrived before the end still counts
+        closed = true;
+        break;
+      }
+      c._in.append(buf, n);
+    }
+
+    const long now = NowNs();
+    size_t idx = 0;
+    while (FCGI_HEADER_LEN <= c._in.size() - idx) {
+      auto head = (const FCGI_Header *)&c._in[idx];
+      const int content_len =
+          (head->contentLengthB1 << 8) | head->contentLengthB0;
+      const size_t complete_len =
+          FCGI_HEADER_LEN + content_len + head->paddingLength;
+      if (c._in.size() - idx < complete_len) break;
+
+      const int id = (head->requestIdB1 << 8) | head->requestIdB0;
+      if (head->type == FCGI_STDOUT) {
+        _bytes += content_len;
+      } else if (head->type == FCGI_END_REQUEST && 0 < id &&
+                 id <= _opts.depth) {
+        auto body =
+            (const FCGI_EndRequestBody *)&c._in[idx + FCGI_HEADER_LEN];
+        if (body->protocolStatus == FCGI_REQUEST_COMPLETE) {
+          _totals._latency.record(now - c._due[id]);
+          ++_completed;
+        } else {
+          ++_errors;
+        }
+        c._free_ids.push_back(id);
+      }
+      idx += complete_len;
+    }
+    c._in.erase(0, idx);
+
+    // without keep-alive the server closes the connection as well
+    if (closed || (!_opts.keep_conn &&
+                   c._free_ids.size() == size_t(_opts.depth))) {
+      disconnect(c);
+    }
+  }
+
+ private:
+  const Options &_opts;
+  const std::vector<std::string> &_requests;
+  const long _end;
+  Totals &_totals;
+  long _interval = 0;
+  long _completed;
+  long _errors;
+  long _bytes;
+  int _epoll;
+  std::vector<Conn> _conns;
+};
+
+////////////////////////////////////////////////////////////////////////////
+
+static bool ParseOptions(int argc, char **argv, Options &opts) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    const bool has_value = i + 1 < argc;
+    if (arg == "--no-keep-alive") {
+      opts.keep_conn = false;
+    } else if (arg == "--sharded") {
+      opts.sharded = true;
+    } else if (arg == "--io-uring") {
+      opts.io_uring = true;
+    } else if (!has_value) {
+      return false;
+    } else if (arg == "--port") {
+      opts.port = atoi(argv[++i]);
+    } else if (arg == "--unix") {
+      opts.unix_path = argv[++i];
+    } else if (arg == "--threads") {
+      opts.threads = atoi(argv[++i]);
+    } else if (arg == "--connections") {
+      opts.connections = atoi(argv[++i]);
+    } else if (arg == "--depth") {
+      opts.depth = atoi(argv[++i]);
+    } else if (arg == "--rate") {
+      opts.rate = atof(argv[++i]);
+    } else if (arg == "--duration") {
+      opts.duration = atof(argv[++i]);
+    } else if (arg == "--request-size") {
+      opts.request_size = atol(argv[++i]);
+    } else if (arg == "--response-size") {
+      opts.response_size = atol(argv[++i]);
+    } else if (arg == "--serve") {
+      opts.serve = atoi(argv[++i]);
+    } else if (arg == "--dispatch") {
+      opts.dispatch = argv[++i];
+    } else if (arg == "--workers") {
+      opts.workers = atoi(argv[++i]);
+    } else {
+      return false;
+    }
+  }
+
+  if (!opts.keep_conn) opts.depth = 1;
+  opts.threads = std::max(1, std::min(opts.threads, opts.connections));
+  return (0 < opts.port || !opts.unix_path.empty()) && 0 < opts.connections &&
+         0 < opts.depth && opts.depth < (1 << 16) && 0 < opts.duration;
+}
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!ParseOptions(argc, argv, opts)) {
+    fputs(s_usage, stderr);
+    return 1;
+  }
+
+  std::vector<std::thread> workers;
+  if (0 < opts.serve && !StartServer(opts, workers)) {
+    fputs(s_usage, stderr);
+    return 1;
+  }
+
+  std::vector<std::string> requests;
+  const std::string body(opts.request_size, 'x');
+  for (int id = 1; id <= opts.depth; ++id)
+    requests.push_back(RequestRecords(id, body, opts.keep_conn));
+
+  Totals totals;
+  const long start = NowNs() + 100 * 1000000L;
+  const long end = start + long(opts.duration * 1e9);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < opts.threads; ++i) {
+    const int connection_num =
+        opts.connections / opts.threads + (i < opts.connections % opts.threads);
+    threads.emplace_back([&, connection_num] {
+      Client client(opts, requests, connection_num, start, end, totals);
+      client.run();
+    });
+  }
+  for (auto &t : threads) t.join();
+
+  const double seconds = opts.duration;
+  const auto latency = totals._latency.snapshot();
+  printf("%ld requests in %.2f s: %.1f req/s, %.1f MB/s of stdout\n",
+         totals._completed.load(), seconds, totals._completed / seconds,
+         totals._bytes / seconds / 1e6);
+  printf("%ld errors, %ld unfinished at the end\n", totals._errors.load(),
+         totals._unfinished.load());
+  if (0 < latency._count) {
+    printf("latency%s: mean %.1f us, p50 %.1f us, p99 %.1f us, "
+           "p99.9 %.1f us, max %.1f us\n",
+           0 < opts.rate ? " from due time" : "",
+           double(latency._sum) / latency._count / 1e3,
+           latency.percentile(50) / 1e3, latency.percentile(99) / 1e3,
+           latency.percentile(99.9) / 1e3, latency.percentile(100) / 1e3);
+  }
+
+  if (0 < opts.serve) StopServer(workers);
+  return totals._completed == 0;
+}
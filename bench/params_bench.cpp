@@ -0,0 +1,131 @@
+// Compares the batch record/params decoder of FcgiRecordReader with the
+// record-at-a-time decoder it replaced, on a read batch of nginx requests.
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "fcgi_bench_fixtures.h"
+#include "fcgi_record.h"
+
+static uint64_t Cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// The previous decoder: every field re-read from the header, every length
+// decoded byte by byte, and a fresh vector per PARAMS record.
+static void LegacyParams(const unsigned char *next, int content_len,
+                         ParamsVector &vec) {
+  while (0 < content_len) {
+    int param_len = 0;
+    FcgiParam param;
+    if ((*next >> 7) == 0) {
+      param._name_len = *next++;
+      ++param_len;
+    } else {
+      param._name_len = int(*next++ & 0x7f) << 24;
+      param._name_len += int(*next++) << 16;
+      param._name_len += int(*next++) << 8;
+      param._name_len += int(*next++);
+      param_len += 4;
+    }
+    param_len += param._name_len;
+    if ((*next >> 7) == 0) {
+      param._value_len = *next++;
+      ++param_len;
+    } else {
+      param._value_len = int(*next++ & 0x7f) << 24;
+      param._value_len += int(*next++) << 16;
+      param._value_len += int(*next++) << 8;
+      param._value_len += int(*next++);
+      param_len += 4;
+    }
+    param_len += param._value_len;
+    param._name = (char *)next;
+    next += param._name_len;
+    param._value = (char *)next;
+    next += param._value_len;
+    vec.push_back(param);
+    content_len -= param_len;
+  }
+}
+
+static long LegacyDecode(const std::string &batch) {
+  long params = 0;
+  const char *buf = batch.data();
+  int idx = 0, len = batch.size();
+  while (FCGI_HEADER_LEN <= len) {
+    const FCGI_Header *head = (const FCGI_Header *)(buf + idx);
+    const int content_len =
+        (int(head->contentLengthB1) << 8) + head->contentLengthB0;
+    const int total = FCGI_HEADER_LEN + content_len + head->paddingLength;
+    if (len < total) break;
+    if (((const FCGI_Header *)(buf + idx))->type == FCGI_PARAMS) {
+      ParamsVector vec;
+      LegacyParams((const unsigned char *)(buf + idx + FCGI_HEADER_LEN),
+                   content_len, vec);
+      params += vec.size();
+    }
+    idx += total;
+    len -= total;
+  }
+  return params;
+}
+
+static long BatchDecode(const std::string &batch,
+                        std::vector<FcgiRecordHead> &heads, ParamsVector &vec) {
+  long params = 0;
+  heads.clear();
+  FcgiRecordReader::decode_heads(batch.data(), batch.size(), heads);
+  const char *record = batch.data();
+  for (auto &h : heads) {
+    if (h._type == FCGI_PARAMS) {
+      vec.clear();
+      FcgiRecordReader::decode_params(record + FCGI_HEADER_LEN, h._content_len,
+                                      vec);
+      params += vec.size();
+    }
+    record += h.complete_length();
+  }
+  return params;
+}
+
+template <typename F>
+static void Run(const char *name, const std::string &batch, int iterations,
+                F f) {
+  long params = 0;
+  const auto t0 = std::chrono::steady_clock::now();
+  const uint64_t c0 = Cycles();
+  for (int i = 0; i < iterations; ++i) params += f();
+  const uint64_t c1 = Cycles();
+  const auto t1 = std::chrono::steady_clock::now();
+
+  const double bytes = double(batch.size()) * iterations;
+  const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+  printf("%-8s %8.1f ns/batch %7.3f bytes/ns", name, ns / iterations,
+         bytes / ns);
+  if (c1 != c0) printf(" %7.3f bytes/cycle", bytes / double(c1 - c0));
+  printf("  (%ld params)\n", params / iterations);
+}
+
+int main(int argc, char **argv) {
+  const int requests = 1 < argc ? atoi(argv[1]) : 32;
+  const int iterations = 2 < argc ? atoi(argv[2]) : 20000;
+
+  std::string batch;
+  for (int i = 0; i < requests; ++i) batch += RequestRecords(1, "");
+  printf("batch: %d requests, %zu bytes\n", requests, batch.size());
+
+  std::vector<FcgiRecordHead> heads;
+  ParamsVector vec;
+  Run("legacy", batch, iterations, [&] { return LegacyDecode(batch); });
+  Run("batch", batch, iterations,
+      [&] { return BatchDecode(batch, heads, vec); });
+  return 0;
+}
@@ -0,0 +1,145 @@
+// Compares the asio reactor with io_uring under many concurrent loopback
+// connections: client threads keep one request in flight on each of their
+// connections and the app echoes a small body back.
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fcgi_app.h"
+#include "fcgi_bench_fixtures.h"
+#include "fcgi_request.h"
+
+static double CpuSeconds() {
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  auto sec = [](const timeval &tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+  return sec(ru.ru_utime) + sec(ru.ru_stime);
+}
+
+// Reads until the END_REQUEST record of one response, false on a broken
+// stream.
+static bool ReadResponse(int sock, std::string &buf) {
+  size_t idx = 0;
+  for (;;) {
+    while (buf.size() - idx < FCGI_HEADER_LEN ||
+           buf.size() - idx <
+               size_t(FCGI_HEADER_LEN +
+                      (((unsigned char)buf[idx + 4] << 8) |
+                       (unsigned char)buf[idx + 5]) +
+                      (unsigned char)buf[idx + 6])) {
+      char chunk[1024 * 16];
+      const ssize_t n = read(sock, chunk, sizeof(chunk));
+      if (n <= 0) return false;
+      buf.append(chunk, n);
+    }
+
+    const unsigned char *h = (const unsigned char *)&buf[idx];
+    idx += FCGI_HEADER_LEN + ((h[4] << 8) | h[5]) + h[6];
+    if (h[1] == FCGI_END_REQUEST) break;
+  }
+  buf.erase(0, idx);
+  return true;
+}
+
+static long StatValue(const std::string &stats, const std::string &key) {
+  const size_t pos = stats.find(" " + key + "=");
+  if (pos == std::string::npos) return 0;
+  return atol(stats.c_str() + pos + key.size() + 2);
+}
+
+static void Run(bool io_uring, int port, int threads, int conns_per_thread,
+                int rounds) {
+  FcgiApp::new_instance();
+  FcgiApp::instance()->set_io_uring(io_uring);
+  // replies go out in more than one send, which Nagle would hold back for
+  // the client's delayed ACK
+  FcgiListenOptions listen_options;
+  listen_options.tcp_nodelay = true;
+  FcgiApp::instance()->listen("127.0.0.1", port, listen_options);
+  FcgiApp::instance()->set_request_handler([](FcgiRequest &req) {
+    req.stdout(req.stdin());
+    req.end_stdout();
+    req.reply(0);
+    return true;
+  });
+  FcgiApp::instance()->start(2);
+  const char *name = !io_uring                        ? "asio"
+                     : FcgiApp::instance()->io_uring() ? "io_uring"
+                                                       : "fallback";
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  const std::string request = RequestRecords(1, std::string(512, 'x'));
+
+  std::atomic<long> done(0);
+  const double cpu0 = CpuSeconds();
+  const auto t0 = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  for (int t = 0; t < threads; ++t) {
+    clients.emplace_back([&] {
+      std::vector<int> socks;
+      for (int i = 0; i < conns_per_thread; ++i) {
+        const int sock = socket(AF_INET, SOCK_STREAM, 0);
+        const int on = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        while (connect(sock, (sockaddr *)&addr, sizeof(addr)) != 0)
+          std::this_thread::yield();
+        socks.push_back(sock);
+      }
+
+      std::string buf;
+      for (int r = 0; r < rounds; ++r) {
+        for (int sock : socks) {
+          if (write(sock, request.data(), request.size()) !=
+              ssize_t(request.size()))
+            return;
+        }
+        for (int sock : socks) {
+          if (!ReadResponse(sock, buf)) return;
+          done.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+      for (int sock : socks) close(sock);
+    });
+  }
+  for (auto &c : clients) c.join();
+  const auto t1 = std::chrono::steady_clock::now();
+  const double cpu1 = CpuSeconds();
+
+  const std::string stats = FcgiApp::instance()->statistics();
+  FcgiApp::delete_instance();
+
+  const long n = done.load();
+  const double sec = std::chrono::duration<double>(t1 - t0).count();
+  printf("%-8s %9.0f req/s %7.2f cpu us/request", name, n / sec,
+         (cpu1 - cpu0) * 1e6 / n);
+  if (StatValue(stats, "io_uring") != 0) {
+    printf(" %5.2f enter/request",
+           double(StatValue(stats, "uring_enter_num")) / n);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  const int threads = 1 < argc ? atoi(argv[1]) : 4;
+  const int conns = 2 < argc ? atoi(argv[2]) : 64;
+  const int rounds = 3 < argc ? atoi(argv[3]) : 500;
+  const int port = 4 < argc ? atoi(argv[4]) : 19001;
+  printf("%d client threads x %d connections, %d rounds\n", threads, conns,
+         rounds);
+
+  Run(false, port, threads, conns, rounds);
+  Run(true, port + 1, threads, conns, rounds);
+  return 0;
+}
@@ -0,0 +1,47 @@
+#include <signal.h>
+#include <unistd.h>
+#include <string>
+#include "fcgi_coroutine.h"
+
+bool s_stop_process = false;
+
+void my_sa_handler(int /*signum*/) { s_stop_process = true; }
+
+void set_sig_handler() {
+  struct sigaction sa;
+  sigemptyset(&sa.sa_mask);
+  sigaddset(&sa.sa_mask, SIGQUIT);
+  sigaddset(&sa.sa_mask, SIGINT);
+  sa.sa_sigaction = nullptr;
+  sa.sa_handler = my_sa_handler;
+  sa.sa_flags = 0;
+  sa.sa_restorer = nullptr;
+
+  sigaction(SIGQUIT, &sa, nullptr);
+  sigaction(SIGINT, &sa, nullptr);
+}
+
+FcgiTask echo(FcgiAsyncRequest &req) {
+  const std::string &body = co_await req.read_stdin();
+  co_await req.write("Content-type: text/html; charset=utf-8\r\n\r\n");
+  co_await req.write(body + "\n");
+  co_await req.finish(0);
+}
+
+// --stream resumes the handler only once a streamed body has arrived.
+int main(int argc, char **argv) {
+  set_sig_handler();
+
+  FcgiApp::new_instance();
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == "--stream")
+      FcgiApp::instance()->set_stdin_streaming(true);
+  }
+  FcgiApp::instance()->serve(echo);
+  FcgiApp::instance()->start(2);
+
+  while (!s_stop_process) sleep(1);
+
+  FcgiApp::delete_instance();
+  return 0;
+}
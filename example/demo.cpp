@@ -1,5 +1,8 @@
 #include <signal.h>
+#include <stdio.h>
 #include <unistd.h>
+#include <memory>
+#include <string>
 #include "fcgi_app.h"
 #include "fcgi_request.h"
 
@@ -21,28 +24,94 @@ void set_sig_handler() {
   sigaction(SIGINT, &sa, nullptr);
 }
 
-int main(int, char **) {
+void echo(FcgiRequest &req, const std::string &body) {
+  std::string str("Content-type: text/html; charset=utf-8\r\n\r\n");
+  str += body + "\n";
+  req.stdout(std::move(str));
+  req.end_stdout();
+  req.reply(0);
+}
+
+void echo(FcgiRequest &req) {
+  if (!req.stdin_streaming()) {
+    echo(req, req.stdin());
+    return;
+  }
+
+  std::string body, chunk;
+  while (req.read_stdin(chunk)) body += chunk;
+  echo(req, body);
+}
+
+// Collects a streamed body on the io thread, then answers the request.
+void echo_async(FcgiRequest *req) {
+  auto body = std::make_shared<std::string>();
+  req->on_stdin([req, body](const boost::asio::const_buffer &buf, bool end) {
+    if (!end) {
+      body->append(static_cast<const char *>(buf.data()), buf.size());
+      return;
+    }
+    echo(*req, *body);
+    FcgiApp::instance()->free_request(req);
+  });
+}
+
+// Requests are answered on the io threads by default; pass --queue to hand
+// them to the main thread through the request queue instead.  --port and
+// --unix listen on 127.0.0.1:port or a Unix socket path rather than on the
+// inherited listening socket, --sharded gives every io thread its own
+// io_service, --stream dispatches requests before their body arrives and
+// --io-uring does the socket io through io_uring.  --metrics prints
+// FcgiApp::metrics() on exit.
+int main(int argc, char **argv) {
   set_sig_handler();
 
   FcgiApp::new_instance();
+
+  bool use_queue = false, print_metrics = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    if (arg == "--queue") {
+      use_queue = true;
+    } else if (arg == "--metrics") {
+      print_metrics = true;
+    } else if (arg == "--sharded") {
+      FcgiApp::instance()->set_sharded(true);
+    } else if (arg == "--io-uring") {
+      FcgiApp::instance()->set_io_uring(true);
+    } else if (arg == "--stream") {
+      FcgiApp::instance()->set_stdin_streaming(true);
+    } else if (arg == "--port" && i + 1 < argc) {
+      FcgiApp::instance()->listen("127.0.0.1", std::stoi(argv[++i]));
+    } else if (arg == "--unix" && i + 1 < argc) {
+      FcgiApp::instance()->listen_unix(argv[++i]);
+    }
+  }
+
+  if (!use_queue && FcgiApp::instance()->stdin_streaming()) {
+    FcgiApp::instance()->set_async_request_handler(echo_async);
+  } else if (!use_queue) {
+    FcgiApp::instance()->set_request_handler([](FcgiRequest &req) {
+      echo(req);
+      return true;
+    });
+  }
   FcgiApp::instance()->start(2);
 
   while (!s_stop_process) {
-    auto req = FcgiApp::instance()->pop_request_nonblocking();
+    auto req = use_queue ? FcgiApp::instance()->pop_request_nonblocking()
+                         : nullptr;
     if (req == nullptr) {
       sleep(1);
       continue;
     }
 
-    std::string str("Content-type: text/html; charset=utf-8\r\n\r\n");
-    str += req->stdin() + "\n";
-    req->stdout(str);
-    req->end_stdout();
-    req->reply(0);
+    echo(*req);
 
     FcgiApp::instance()->free_request(req);
   }
 
+  if (print_metrics) fputs(FcgiApp::instance()->metrics().c_str(), stdout);
   FcgiApp::delete_instance();
   return 0;
 }
@@ -3,14 +3,63 @@
 
 #include <atomic>
 #include <boost/asio.hpp>
-#include <condition_variable>
-#include <mutex>
-#include <queue>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
+#include "fcgi_counter.h"
+#include "fcgi_queue.h"
 
+class FcgiMetricsWriter;
 class FcgiRequest;
+class FcgiTimerWheel;
+class FcgiUring;
+
+struct FcgiListenOptions {
+  FcgiListenOptions()
+      : backlog(boost::asio::socket_base::max_listen_connections),
+        linger(30),
+        tcp_nodelay(false),
+        recv_buffer_size(0),
+        send_buffer_size(0) {}
+
+  int backlog;
+  // seconds SO_LINGER waits on close of accepted sockets, -1 to disable
+  int linger;
+  bool tcp_nodelay;
+  // 0 keeps the system default
+  int recv_buffer_size;
+  int send_buffer_size;
+};
+
+// A connection is closed once it has spent idle_timeout with nothing to
+// receive, answer or send, params_timeout between a BEGIN_REQUEST and the end
+// of its PARAMS, stdin_timeout without any of a body it waits for, or
+// write_timeout without any output going out.  0 disables a timeout.
+struct FcgiTimeouts {
+  FcgiTimeouts()
+      : idle_timeout(60 * 1000),
+        params_timeout(30 * 1000),
+        stdin_timeout(60 * 1000),
+        write_timeout(60 * 1000) {}
+
+  std::chrono::milliseconds idle_timeout;
+  std::chrono::milliseconds params_timeout;
+  std::chrono::milliseconds stdin_timeout;
+  std::chrono::milliseconds write_timeout;
+};
+
+// Invoked on the io thread that parsed the request.  Returning true means the
+// request has been answered and it is freed right away; returning false hands
+// it over to the queue for pop_request_blocking()/pop_request_nonblocking().
+using FcgiRequestHandler = std::function<bool(FcgiRequest &)>;
+
+// Like FcgiRequestHandler, but takes ownership of the request: it must be
+// passed to FcgiApp::free_request() once the handler is done with it, which
+// may be long after the call returns.
+using FcgiAsyncRequestHandler = std::function<void(FcgiRequest *)>;
 
 class FcgiApp {
  private:
@@ -23,38 +72,171 @@ class FcgiApp {
   static void new_instance();
   static void delete_instance();
   static FcgiApp *instance();
+  // True on the threads running the io_services, which must never block.
+  static bool in_io_thread();
 
  public:
+  // Without sharding all thread_num threads drive one io_service.  With it
+  // every thread owns an io_service pinned to one core, and each connection
+  // stays on the shard that accepted it.
   void start(int thread_num);
 
+  // These must be called before start().
+  void set_sharded(bool);
+  // Drives accepts, reads and writes through one io_uring per io_service
+  // instead of asio's reactor.  Falls back to the reactor where the kernel
+  // has no io_uring; io_uring() tells which one is in use once started.
+  void set_io_uring(bool);
+  bool io_uring() const;
+
+  // With stdin streaming requests are dispatched as soon as their params are
+  // complete, and the handler consumes the body through
+  // FcgiRequest::read_stdin() or FcgiRequest::on_stdin() while it arrives.
+  // A handler run on the io thread, as set_request_handler() ones are, must
+  // use on_stdin(): read_stdin() would wait for data only that thread reads.
+  void set_stdin_streaming(bool);
+  bool stdin_streaming() const;
+
+  // A connection with more than high bytes of unsent output is no longer
+  // FcgiRequest::writable(), and FcgiRequest::on_writable() callbacks fire
+  // once it is down to low bytes.
+  void set_write_watermarks(long high, long low);
+  long write_high_watermark() const;
+  long write_low_watermark() const;
+
+  void set_timeouts(const FcgiTimeouts &);
+  const FcgiTimeouts &timeouts() const;
+
+  // Listeners, any number of which may be combined.  Without any the app
+  // listens on the inherited FCGI_LISTENSOCK_FILENO.  When sharded, every
+  // shard gets its own SO_REUSEPORT acceptor for each TCP listener; the
+  // others hand accepted sockets to the shards round robin.
+  void listen(const std::string &host, unsigned short port,
+              const FcgiListenOptions & = FcgiListenOptions());
+  void listen_unix(const std::string &path,
+                   const FcgiListenOptions & = FcgiListenOptions());
+  void listen_fd(int fd, const FcgiListenOptions & = FcgiListenOptions());
+  void set_queue_capacity(int);
+  void set_queue_spin_count(int);
+
+  // Admission control, where 0 means no limit.  Sockets accepted beyond
+  // max_conns connections are closed right away, and requests beyond
+  // max_reqs in progress are answered FCGI_OVERLOADED before their params are
+  // parsed.  FCGI_GET_VALUES reports both as FCGI_MAX_CONNS/FCGI_MAX_REQS.
+  void set_max_conns(int);
+  void set_max_reqs(int);
+  // New requests are answered FCGI_OVERLOADED as well while queue_depth
+  // requests wait in the queue, or while the last one popped had waited
+  // queue_wait or longer.
+  void set_overload_thresholds(int queue_depth,
+                               std::chrono::milliseconds queue_wait);
+  bool overloaded() const;
+  // Called by connections: false if a new request is to be turned away,
+  // otherwise it counts until free_request().
+  bool admit_request();
+
+  void set_request_handler(FcgiRequestHandler);
+  void set_async_request_handler(FcgiAsyncRequestHandler);
+
+  // Runs handler, a coroutine returning FcgiTask, for every request.  Defined
+  // in fcgi_coroutine.h.
+  template <typename Handler>
+  void serve(Handler handler);
+
+  void dispatch_request(FcgiRequest *);
+
   FcgiRequest *pop_request_blocking();
   FcgiRequest *pop_request_nonblocking();
-  void push_request(FcgiRequest *);
+  // False, leaving the request to the caller, when the queue is full.
+  bool push_request(FcgiRequest *);
   void free_request(FcgiRequest *);
 
+  bool get_value(const std::string &name, std::string &value) const;
+
   void decrease_connection_num();
   void reset_statistics();
   std::string statistics() const;
+  // Everything statistics() has and the latency histograms of FcgiMetrics,
+  // in the Prometheus text format or as FcgiMetricsWriter's binary snapshot.
+  std::string metrics() const;
+  std::string metrics_snapshot() const;
 
  private:
-  void post_async_accept();
-  void accept_handler(boost::asio::ip::tcp::socket *,
-                      const boost::system::error_code &);
-  void io_function();
+  struct Listener {
+    boost::asio::generic::stream_protocol::endpoint _endpoint;
+    // inherited listening socket, -1 if _endpoint has to be bound
+    int _fd;
+    FcgiListenOptions _options;
+  };
+
+  struct Acceptor {
+    boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol>
+        *_acceptor;
+    // shard accepted sockets are bound to, -1 to spread them round robin
+    int _shard;
+    FcgiListenOptions _options;
+    // cleared if the kernel turns down multishot accept
+    bool _uring_accept;
+  };
+
+  void open_acceptor(const Listener &, int shard);
+  void post_async_accept(Acceptor *);
+  void accept_handler(
+      Acceptor *,
+      std::unique_ptr<boost::asio::generic::stream_protocol::socket>,
+      int shard, const boost::system::error_code &);
+  void uring_accept_handler(Acceptor *, int res, unsigned flags);
+  int next_shard(const Acceptor *);
+  bool admit_connection();
+  bool drop_cancelled(FcgiRequest *);
+  void reject_request(FcgiRequest *);
+  bool dequeued(FcgiRequest *);
+  void collect_metrics(FcgiMetricsWriter &) const;
+  void io_function(int shard);
+  void post_trim_pools();
 
  private:
-  boost::asio::io_service _io_service;
-  boost::asio::ip::tcp::acceptor *_acceptor;
+  using WorkGuard =
+      boost::asio::executor_work_guard<boost::asio::io_service::executor_type>;
+
+  std::vector<std::unique_ptr<boost::asio::io_service>> _io_services;
+  // one per io_service when io_uring is in use
+  std::vector<std::unique_ptr<FcgiUring>> _urings;
+  // one per io_service, reaping its connections on timeouts
+  std::vector<std::unique_ptr<FcgiTimerWheel>> _wheels;
+  std::vector<WorkGuard> _work_guards;
+  std::vector<std::unique_ptr<Acceptor>> _acceptors;
+  std::vector<Listener> _listeners;
   std::vector<std::thread> _io_thread_group;
+  std::unique_ptr<boost::asio::steady_timer> _trim_timer;
+  bool _sharded;
+  bool _io_uring;
+  bool _stdin_streaming;
+  long _write_high_watermark;
+  long _write_low_watermark;
+  FcgiTimeouts _timeouts;
+  std::atomic_uint _next_shard;
+
+  FcgiRequestQueue *_queue;
+  FcgiRequestHandler _handler;
+  FcgiAsyncRequestHandler _async_handler;
 
-  std::mutex _mutex;
-  std::condition_variable _cond;
-  std::queue<FcgiRequest *> _queue;
+  int _max_conns;
+  int _max_reqs;
+  int _overload_queue_depth;
+  long _overload_queue_wait_us;
+  // how long the last request popped had waited in the queue
+  std::atomic_long _queue_wait_us;
 
   int _thread_num;
-  int _dequeue_req_num;
-  int _enqueue_req_num;
+  FcgiCounter _dequeue_req_num;
+  FcgiCounter _enqueue_req_num;
+  FcgiCounter _inline_req_num;
+  FcgiCounter _rejected_conn_num;
+  FcgiCounter _rejected_req_num;
+  FcgiCounter _cancelled_req_num;
   std::atomic_int _connection_num;
+  std::atomic_int _request_num;
 
   static FcgiApp *s_app;
 };
@@ -0,0 +1,139 @@
+#ifndef FCGI_BUFFER_H_
+#define FCGI_BUFFER_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "fcgi_counter.h"
+
+/*
+ * Shared pool of byte buffers used by FcgiRecordReader/FcgiRecordWriter.
+ *
+ * Buffers come in power-of-two size classes from FCGI_BUFFER_MIN_LEN up to
+ * FCGI_BUFFER_MAX_LEN.  Each thread keeps a short free list per class and
+ * spills to (or refills from) a shared list when it runs over (or dry).
+ */
+static const int FCGI_BUFFER_MIN_LEN = 1024 * 4;
+static const int FCGI_BUFFER_MAX_LEN = 1024 * 1024;
+
+class FcgiBufferPool {
+ private:
+  FcgiBufferPool();
+  ~FcgiBufferPool();
+  FcgiBufferPool(const FcgiBufferPool &) = delete;
+  FcgiBufferPool &operator=(const FcgiBufferPool &) = delete;
+
+ public:
+  static FcgiBufferPool *instance();
+
+  static int class_num();
+  static int class_index(int len);
+  static int class_length(int idx);
+
+ public:
+  // Returns a buffer of at least len bytes (len <= FCGI_BUFFER_MAX_LEN) and
+  // stores its real capacity in *cap.
+  char *acquire(int len, int *cap);
+  void release(char *buf, int cap);
+
+  std::string statistics() const;
+  long in_use_bytes() const;
+  long cached_bytes() const;
+
+ private:
+  struct ThreadCache;
+  static ThreadCache &thread_cache();
+
+  bool push_shared(int idx, char *buf);
+  char *pop_shared(int idx);
+
+ private:
+  struct SizeClass {
+    std::mutex _mutex;
+    std::vector<char *> _free;
+  };
+
+  std::vector<SizeClass> _classes;
+
+  std::atomic_long _in_use_num;
+  std::atomic_long _in_use_bytes;
+  std::atomic_long _cached_num;
+  std::atomic_long _cached_bytes;
+};
+
+/*
+ * Ring buffer whose storage is mapped twice back to back, so that bytes
+ * wrapping past the end are still contiguous at data() + offset as long as
+ * offset + len <= 2 * capacity().  Capacity is rounded up to whole pages.
+ *
+ * Needs memfd_create(); elsewhere, or if the mapping fails, it is a plain
+ * buffer and mirrored() is false.
+ */
+class FcgiRingBuffer {
+ public:
+  explicit FcgiRingBuffer(int len);
+  ~FcgiRingBuffer();
+  FcgiRingBuffer(const FcgiRingBuffer &) = delete;
+  FcgiRingBuffer &operator=(const FcgiRingBuffer &) = delete;
+
+ public:
+  char *data() const;
+  int capacity() const;
+  bool mirrored() const;
+
+  // capacity a ring asked for len bytes gets
+  static int capacity_for(int len);
+
+ private:
+  bool map_mirror();
+
+ private:
+  char *_data;
+  int _cap;
+  bool _mirrored;
+};
+
+/*
+ * Rings for FcgiRecordReader in the size classes of FcgiBufferPool, so that
+ * neither a new connection nor a record too large for the smallest ring
+ * pays for a memfd and its mappings.  Each class keeps a bounded list of
+ * free rings; trim() unmaps the ones nobody has asked for since the
+ * previous trim(), so an idle pool shrinks back to nothing.
+ */
+class FcgiRingPool {
+ private:
+  FcgiRingPool();
+  ~FcgiRingPool();
+  FcgiRingPool(const FcgiRingPool &) = delete;
+  FcgiRingPool &operator=(const FcgiRingPool &) = delete;
+
+ public:
+  static FcgiRingPool *instance();
+  // capacity of the rings acquire(len) returns
+  static int capacity(int len);
+
+ public:
+  FcgiRingBuffer *acquire(int len);
+  void release(FcgiRingBuffer *);
+  void trim();
+
+  std::string statistics() const;
+
+ private:
+  struct SizeClass {
+    std::mutex _mutex;
+    std::vector<FcgiRingBuffer *> _free;
+    // the rings at the bottom of _free, up to _low of them, have not been
+    // handed out since the last trim()
+    int _low;
+  };
+
+  std::vector<SizeClass> _classes;
+
+  FcgiCounter _hit_num;
+  FcgiCounter _miss_num;
+  FcgiCounter _trim_num;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef FCGI_CANCEL_H_
+#define FCGI_CANCEL_H_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+using FcgiCancelCallback = std::function<void()>;
+
+/*
+ * Tells a request's handler that its response is no longer wanted, because
+ * the web server sent FCGI_ABORT_REQUEST or the connection was lost.
+ *
+ * Shared by the request and its connection so that neither has to outlive
+ * the other.  Handlers poll cancelled() or register callbacks, which run
+ * once, on the thread that cancels.
+ */
+class FcgiCancelToken {
+ public:
+  FcgiCancelToken();
+  FcgiCancelToken(const FcgiCancelToken &) = delete;
+  FcgiCancelToken &operator=(const FcgiCancelToken &) = delete;
+
+ public:
+  bool cancelled() const;
+  // Runs callback right away if cancelled already.
+  void on_cancel(FcgiCancelCallback);
+  void cancel();
+  // Back to the initial state for the next request of a pooled one.
+  void reset();
+
+ private:
+  std::atomic_bool _cancelled;
+  std::mutex _mutex;
+  std::vector<FcgiCancelCallback> _callbacks;
+};
+
+#endif
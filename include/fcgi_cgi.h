@@ -0,0 +1,127 @@
+#ifndef FCGI_CGI_H_
+#define FCGI_CGI_H_
+
+#include <stdint.h>
+#include <iterator>
+#include <string_view>
+
+/*
+ * Well-known CGI variables, resolved through a perfect hash that is built at
+ * compile time.  FcgiParamTable files each of them in a fixed slot while the
+ * params are parsed, so FcgiRequest::known() needs no hashing or string
+ * comparison at all.
+ */
+enum class CgiVar : int {
+  RequestMethod,
+  RequestUri,
+  RequestScheme,
+  QueryString,
+  ScriptName,
+  ScriptFilename,
+  PathInfo,
+  DocumentUri,
+  DocumentRoot,
+  ContentType,
+  ContentLength,
+  ServerProtocol,
+  ServerSoftware,
+  ServerName,
+  ServerAddr,
+  ServerPort,
+  RemoteAddr,
+  RemotePort,
+  GatewayInterface,
+  RedirectStatus,
+  Https,
+  HttpHost,
+  HttpUserAgent,
+  HttpAccept,
+  HttpAcceptEncoding,
+  HttpAcceptLanguage,
+  HttpCookie,
+  HttpConnection,
+  HttpReferer,
+  HttpXForwardedFor,
+};
+
+namespace fcgi_detail {
+
+inline constexpr std::string_view kCgiVarNames[] = {
+    "REQUEST_METHOD",       "REQUEST_URI",          "REQUEST_SCHEME",
+    "QUERY_STRING",         "SCRIPT_NAME",          "SCRIPT_FILENAME",
+    "PATH_INFO",            "DOCUMENT_URI",         "DOCUMENT_ROOT",
+    "CONTENT_TYPE",         "CONTENT_LENGTH",       "SERVER_PROTOCOL",
+    "SERVER_SOFTWARE",      "SERVER_NAME",          "SERVER_ADDR",
+    "SERVER_PORT",          "REMOTE_ADDR",          "REMOTE_PORT",
+    "GATEWAY_INTERFACE",    "REDIRECT_STATUS",      "HTTPS",
+    "HTTP_HOST",            "HTTP_USER_AGENT",      "HTTP_ACCEPT",
+    "HTTP_ACCEPT_ENCODING", "HTTP_ACCEPT_LANGUAGE", "HTTP_COOKIE",
+    "HTTP_CONNECTION",      "HTTP_REFERER",         "HTTP_X_FORWARDED_FOR",
+};
+
+inline constexpr int kCgiSlotBits = 7;
+
+constexpr uint32_t cgi_slot(std::string_view s, uint32_t seed) {
+  uint32_t h = seed ^ uint32_t(s.size());
+  if (!s.empty()) {
+    const size_t n = s.size();
+    for (size_t pos : {size_t(0), n / 2, n - 1, n < 2 ? 0 : n - 2})
+      h = (h ^ (unsigned char)s[pos]) * 16777619u;
+  }
+  return (h * 0x9e3779b1u) >> (32 - kCgiSlotBits);
+}
+
+struct CgiHashTable {
+  uint32_t _seed;
+  int8_t _slots[1 << kCgiSlotBits];
+};
+
+// Tries seeds until every well-known name lands in a slot of its own.
+constexpr CgiHashTable make_cgi_hash_table() {
+  for (uint32_t seed = 1;; ++seed) {
+    CgiHashTable t{seed, {}};
+    for (auto &slot : t._slots) slot = -1;
+
+    bool ok = true;
+    for (int i = 0; ok && i < int(std::size(kCgiVarNames)); ++i) {
+      const uint32_t slot = cgi_slot(kCgiVarNames[i], seed);
+      if (t._slots[slot] != -1) ok = false;
+      t._slots[slot] = i;
+    }
+    if (ok) return t;
+  }
+}
+
+inline constexpr CgiHashTable kCgiHashTable = make_cgi_hash_table();
+
+}  // namespace fcgi_detail
+
+inline constexpr int CGI_VAR_NUM = std::size(fcgi_detail::kCgiVarNames);
+
+constexpr std::string_view cgi_var_name(CgiVar var) {
+  return fcgi_detail::kCgiVarNames[int(var)];
+}
+
+// Index of name in CgiVar, or -1 if it is not a well-known variable.
+constexpr int cgi_var_index(std::string_view name) {
+  using namespace fcgi_detail;
+  const int idx = kCgiHashTable._slots[cgi_slot(name, kCgiHashTable._seed)];
+  return (0 <= idx && kCgiVarNames[idx] == name) ? idx : -1;
+}
+
+namespace fcgi_detail {
+
+constexpr bool cgi_hash_table_ok() {
+  for (int i = 0; i < CGI_VAR_NUM; ++i) {
+    if (cgi_var_index(kCgiVarNames[i]) != i) return false;
+  }
+  return true;
+}
+
+}  // namespace fcgi_detail
+
+static_assert(int(CgiVar::HttpXForwardedFor) + 1 == CGI_VAR_NUM,
+              "CgiVar and kCgiVarNames are out of sync");
+static_assert(fcgi_detail::cgi_hash_table_ok(), "");
+
+#endif
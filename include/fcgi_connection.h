@@ -1,26 +1,66 @@
 #ifndef FCGI_CONNECTION_H_
 #define FCGI_CONNECTION_H_
 
+#include <sys/socket.h>
 #include <boost/asio.hpp>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "fcgi_pool.h"
 #include "fcgi_record.h"
+#include "fcgi_timer.h"
+class FcgiCancelToken;
 class FcgiRequest;
+class FcgiStdinStream;
+class FcgiUring;
 enum class ParseRecordError;
 
+// Any stream socket (TCP over IPv4/IPv6, Unix domain, ...) is handled
+// through asio's protocol independent stream socket.
+using FcgiSocket = boost::asio::generic::stream_protocol::socket;
+using FcgiAcceptor =
+    boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol>;
+
 class FcgiConnection : public std::enable_shared_from_this<FcgiConnection> {
  public:
-  FcgiConnection(boost::asio::ip::tcp::socket *);
+  FcgiConnection();
   virtual ~FcgiConnection();
   FcgiConnection(const FcgiConnection &) = delete;
   FcgiConnection &operator=(const FcgiConnection &) = delete;
 
  public:
+  // Takes a connection, read and write buffers included, from
+  // FcgiObjectPool<FcgiConnection>; it goes back there once the last
+  // reference is dropped.
+  static std::shared_ptr<FcgiConnection> create(FcgiSocket *);
+  // Socket accepted through, and to be driven by, the io_uring.
+  static std::shared_ptr<FcgiConnection> create(int fd, FcgiUring *);
+  void recycle();
+
   void post_async_read();
+  // Restarts reading once no stdin stream is backlogged any more.
+  void resume_read();
 
   bool stdout(int request_id, boost::asio::const_buffers_1 &);
+  bool stdout(int request_id, const boost::asio::const_buffer &,
+              std::shared_ptr<const void> owner, FcgiWriteCallback);
+  bool stdout_file(int request_id, int fd, off_t offset, size_t len,
+                   std::shared_ptr<const void> owner, FcgiWriteCallback);
   bool end_stdout(int request_id);
-  bool reply(int request_id, uint32_t code, bool close);
+  bool reply(int request_id, uint32_t code, uint8_t protocol_status,
+             bool close);
+  // Forgets a dispatched request, answered or not, once it is freed.
+  void release_request(int request_id,
+                       const std::shared_ptr<FcgiCancelToken> &);
+
+  bool writable();
+  void on_writable(FcgiWriteCallback);
+
+  // Enforces FcgiApp::timeouts() from then on.
+  void start_timer(FcgiTimerWheel *);
+  // Called by the wheel for the check scheduled at when.
+  void check_timeouts(long when, long now);
 
  private:
   void close();
@@ -30,6 +70,7 @@ class FcgiConnection : public std::enable_shared_from_this<FcgiConnection> {
                     size_t bytes_transferred);
   void write_handler(const boost::system::error_code &,
                      size_t bytes_transferred);
+  void send_file_handler(const boost::system::error_code &);
   void post_async_write();
 
   ParseRecordError parse_record();
@@ -40,16 +81,62 @@ class FcgiConnection : public std::enable_shared_from_this<FcgiConnection> {
   ParseRecordError parse_stdin_record();
   ParseRecordError parse_data_record();
 
-  int deal_request();
+  FcgiRequest *find_request(int request_id) const;
+  int deal_request(int request_id);
+  int end_params(int request_id);
+  int stream_request(int request_id);
+  bool streams_backlogged() const;
+  void cancel_requests();
+  long next_deadline(FcgiTimeout *) const;
+  void arm_timer();
+  void update_read_deadline();
 
  private:
-  boost::asio::ip::tcp::socket *_sock;
+  // null when driven by _uring, which works on _fd alone
+  FcgiSocket *_sock;
+  int _fd;
+  FcgiUring *_uring;
+  std::vector<iovec> _iovecs;
+  msghdr _msg;
   FcgiRecordReader _reader;
   FcgiRecordWriter _writer;
-  FcgiRequest *_req;
+  // reused by every PARAMS record to keep its capacity
+  ParamsVector _params_vec;
+  std::unordered_map<int, FcgiRequest *> _reqs;
+  // requests dispatched before the end of their stdin
+  std::unordered_map<int, std::shared_ptr<FcgiStdinStream>> _streams;
+  // dispatched requests neither answered nor freed yet
+  std::unordered_map<int, std::shared_ptr<FcgiCancelToken>> _cancel_tokens;
+  // requests dispatched without a body whose empty STDIN is still to come;
+  // any other STDIN for them is a protocol error
+  std::unordered_set<int> _bodyless_ids;
+  // no read is pending while paused, this keeps the connection alive
+  std::shared_ptr<FcgiConnection> _paused_self;
+  // waiting for unsent output to fall to the low watermark
+  std::vector<FcgiWriteCallback> _writable_callbacks;
   bool _has_pending_write;
   bool _close_on_finish_write;
+  // dispatched requests not freed yet, the connection is not idle before
+  int _dispatched_num;
+  // FcgiMetrics::now_ns() at create()
+  long _created_ns;
+
+  // timeouts, in _wheel's milliseconds
+  FcgiTimerWheel *_wheel;
+  // when the wheel checks on the connection next
+  long _timer_at;
+  // last read or write progress
+  long _active_at;
+  long _write_progress_at;
+  // params or stdin deadline set by the read path
+  long _read_deadline;
+  FcgiTimeout _read_timeout;
+  // requests whose params are not complete, by when they began
+  std::unordered_map<int, long> _params_begun;
   std::mutex _mutex;
 };
 
+template <>
+FcgiObjectPool<FcgiConnection> *FcgiObjectPool<FcgiConnection>::instance();
+
 #endif
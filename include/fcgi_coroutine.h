@@ -0,0 +1,230 @@
+#ifndef FCGI_COROUTINE_H_
+#define FCGI_COROUTINE_H_
+
+#if !defined(__cpp_impl_coroutine)
+#error "fcgi_coroutine.h requires C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#include "fcgi_app.h"
+#include "fcgi_request.h"
+
+/*
+ * Coroutine front end for FcgiRequest.
+ *
+ *   FcgiApp::instance()->serve([](FcgiAsyncRequest &req) -> FcgiTask {
+ *     const std::string &body = co_await req.read_stdin();
+ *     co_await req.write("Content-type: text/plain\r\n\r\n" + body);
+ *     co_await req.finish(0);
+ *   });
+ *
+ * Handlers start on the io thread that parsed the request and resume on the
+ * io thread that completed the awaited operation, so no worker thread is
+ * held while a request waits.
+ */
+
+class FcgiTask {
+ public:
+  struct promise_type {
+    struct FinalAwaitable {
+      bool await_ready() const noexcept { return false; }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<promise_type> h) noexcept {
+        auto continuation = h.promise()._continuation;
+        return continuation ? continuation : std::noop_coroutine();
+      }
+      void await_resume() const noexcept {}
+    };
+
+    FcgiTask get_return_object() {
+      return FcgiTask(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaitable final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() { _exception = std::current_exception(); }
+
+    std::coroutine_handle<> _continuation;
+    std::exception_ptr _exception;
+  };
+
+ public:
+  explicit FcgiTask(std::coroutine_handle<promise_type> h) : _handle(h) {}
+  FcgiTask(FcgiTask &&other) : _handle(std::exchange(other._handle, nullptr)) {}
+  ~FcgiTask() {
+    if (_handle) _handle.destroy();
+  }
+  FcgiTask(const FcgiTask &) = delete;
+  FcgiTask &operator=(const FcgiTask &) = delete;
+
+ public:
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+    _handle.promise()._continuation = h;
+    return _handle;
+  }
+  void await_resume() const {
+    if (_handle.promise()._exception)
+      std::rethrow_exception(_handle.promise()._exception);
+  }
+
+ private:
+  std::coroutine_handle<promise_type> _handle;
+};
+
+// Result of an operation that has already completed when it is awaited.
+template <typename T>
+class FcgiReadyAwaitable {
+ public:
+  explicit FcgiReadyAwaitable(T value) : _value(value) {}
+
+  bool await_ready() const noexcept { return true; }
+  void await_suspend(std::coroutine_handle<>) const noexcept {}
+  T await_resume() const noexcept { return _value; }
+
+ private:
+  T _value;
+};
+
+// Sends a buffer through the zero-copy stdout path and resumes once the
+// connection has handed it to the socket.  Yields false if the bytes could
+// not be queued or the connection went away before they were sent.
+class FcgiWriteAwaitable {
+ public:
+  FcgiWriteAwaitable(FcgiRequest *req, std::shared_ptr<const std::string> data)
+      : _req(req), _data(std::move(data)), _ok(false) {}
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> h) {
+    _handle = h;
+    // once stdout() succeeds the callback may resume the coroutine on another
+    // thread at any moment, so *this must not be touched afterwards.
+    return _req->stdout(std::move(_data), [this](bool ok) {
+      _ok = ok;
+      _handle.resume();
+    });
+  }
+  bool await_resume() const noexcept { return _ok; }
+
+ private:
+  FcgiRequest *_req;
+  std::shared_ptr<const std::string> _data;
+  std::coroutine_handle<> _handle;
+  bool _ok;
+};
+
+// Yields the whole request body.  A streamed body is collected as it
+// arrives and the coroutine resumes on the io thread that read its end.
+class FcgiStdinAwaitable {
+ public:
+  FcgiStdinAwaitable(FcgiRequest *req, std::string *body)
+      : _req(req), _body(body) {}
+
+  bool await_ready() const noexcept { return !_req->stdin_streaming(); }
+  void await_suspend(std::coroutine_handle<> h) {
+    std::string *body = _body;
+    _req->on_stdin([body, h](const boost::asio::const_buffer &buf, bool end) {
+      if (end) {
+        h.resume();
+      } else {
+        body->append(static_cast<const char *>(buf.data()), buf.size());
+      }
+    });
+  }
+  const std::string &await_resume() const noexcept {
+    return _req->stdin_streaming() ? *_body : _req->stdin();
+  }
+
+ private:
+  FcgiRequest *_req;
+  std::string *_body;
+};
+
+class FcgiAsyncRequest {
+ public:
+  explicit FcgiAsyncRequest(FcgiRequest *req)
+      : _req(req), _written(false), _finished(false) {}
+  FcgiAsyncRequest(const FcgiAsyncRequest &) = delete;
+  FcgiAsyncRequest &operator=(const FcgiAsyncRequest &) = delete;
+
+ public:
+  FcgiRequest &request() const { return *_req; }
+
+  FcgiStdinAwaitable read_stdin() {
+    return FcgiStdinAwaitable(_req, &_body);
+  }
+
+  FcgiWriteAwaitable write(std::string str) {
+    auto data = std::make_shared<const std::string>(std::move(str));
+    return write(std::move(data));
+  }
+
+  FcgiWriteAwaitable write(std::shared_ptr<const std::string> str) {
+    _written = true;
+    return FcgiWriteAwaitable(_req, std::move(str));
+  }
+
+  FcgiReadyAwaitable<bool> finish(uint32_t code) {
+    _finished = true;
+    return FcgiReadyAwaitable<bool>(_req->end_stdout() && _req->reply(code));
+  }
+
+  // Ends a request whose handler threw before finishing it, with a 500 if
+  // nothing has been written yet, and a non-zero app status either way.
+  void fail() {
+    if (_finished) return;
+    _finished = true;
+    if (!_written)
+      _req->stdout(std::string("Status: 500 Internal Server Error\r\n\r\n"));
+    _req->end_stdout();
+    _req->reply(1);
+  }
+
+ private:
+  FcgiRequest *_req;
+  std::string _body;
+  bool _written;
+  bool _finished;
+};
+
+namespace fcgi_detail {
+
+// Eagerly started coroutine that frees its own frame when it completes.
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    // serve_request() catches whatever handlers throw
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+
+template <typename Handler>
+DetachedTask serve_request(Handler handler, FcgiRequest *req) {
+  {
+    FcgiAsyncRequest async_req(req);
+    try {
+      co_await handler(async_req);
+    } catch (...) {
+      async_req.fail();
+    }
+  }
+  FcgiApp::instance()->free_request(req);
+}
+
+}  // namespace fcgi_detail
+
+template <typename Handler>
+void FcgiApp::serve(Handler handler) {
+  set_async_request_handler([handler](FcgiRequest *req) {
+    fcgi_detail::serve_request(handler, req);
+  });
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef FCGI_COUNTER_H_
+#define FCGI_COUNTER_H_
+
+#include <atomic>
+
+/*
+ * Counter sharded over cache-line sized slots.  Writers touch only the slot
+ * picked for their thread, readers sum all of them.
+ */
+class FcgiCounter {
+ public:
+  FcgiCounter();
+  FcgiCounter(const FcgiCounter &) = delete;
+  FcgiCounter &operator=(const FcgiCounter &) = delete;
+
+ public:
+  void add(long n = 1);
+  long load() const;
+  void reset();
+
+  static int shard_index();
+
+ public:
+  static const int SHARD_NUM = 16;
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic_long _value;
+  };
+  Shard _shards[SHARD_NUM];
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef FCGI_METRICS_H_
+#define FCGI_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "fcgi_counter.h"
+
+/*
+ * Log-linear histogram in the style of HdrHistogram.  Values under 16 get a
+ * bucket each and every power of two above is split in 16 buckets, so a
+ * bucket is never wider than 1/16 of the values in it; values of 2^40 and
+ * more share the last one.  Like FcgiCounter the buckets are sharded by
+ * thread and only summed on read.
+ */
+class FcgiHistogram {
+ public:
+  FcgiHistogram();
+  FcgiHistogram(const FcgiHistogram &) = delete;
+  FcgiHistogram &operator=(const FcgiHistogram &) = delete;
+
+ public:
+  static const int SUB_BITS = 4;
+  static const int MAX_BITS = 40;
+  static const int BUCKET_NUM = (MAX_BITS - SUB_BITS + 1) << SUB_BITS;
+
+  struct Snapshot {
+    // upper bound of the bucket holding the p-th percentile, p in [0, 100]
+    long percentile(double p) const;
+
+    long _count;
+    long _sum;
+    std::vector<long> _buckets;
+  };
+
+  void record(long value);
+  Snapshot snapshot() const;
+  void reset();
+
+  static int bucket_index(long value);
+  // largest value falling into bucket idx
+  static long bucket_upper(int idx);
+
+ private:
+  static const int SHARD_NUM = 8;
+
+  struct alignas(64) Shard {
+    std::atomic_long _sum;
+    std::atomic_long _buckets[BUCKET_NUM];
+  };
+  std::unique_ptr<Shard[]> _shards;
+};
+
+/*
+ * Gathers samples and renders them either in the Prometheus text format or
+ * as a compact binary snapshot:
+ *
+ *   "FCGM" version:u8 sample_num:varint, then for each sample
+ *   kind:u8 (0 counter, 1 gauge, 2 histogram) name_len:varint name, and
+ *     counter, gauge: value:zigzag varint
+ *     histogram: unit_ns:varint count:varint sum:varint bucket_num:varint,
+ *                then bucket_num pairs of index_delta:varint count:varint
+ *                for the non-empty buckets, see FcgiHistogram
+ *
+ * Varints are LEB128.  A name may carry Prometheus labels, as in
+ * fcgi_records_total{type="params"}.
+ */
+class FcgiMetricsWriter {
+ public:
+  void counter(const std::string &name, const char *help, long value);
+  void gauge(const std::string &name, const char *help, long value);
+  // values of h are in units of unit_ns nanoseconds, exported in seconds
+  void histogram(const std::string &name, const char *help,
+                 const FcgiHistogram &h, long unit_ns);
+
+  std::string prometheus() const;
+  std::string snapshot() const;
+
+ private:
+  enum Kind { Counter, Gauge, Histogram };
+
+  struct Sample {
+    Kind _kind;
+    std::string _name;
+    const char *_help;
+    long _value;
+    long _unit_ns;
+    FcgiHistogram::Snapshot _histogram;
+  };
+  std::vector<Sample> _samples;
+};
+
+/*
+ * What the library measures on its hot paths, aggregated only when
+ * FcgiApp::metrics() or FcgiApp::metrics_snapshot() reads it.  Handler time
+ * is sampled: each thread times one request in handler_sample_period(), so
+ * that most requests take no extra clock read.
+ */
+class FcgiMetrics {
+ private:
+  FcgiMetrics();
+  FcgiMetrics(const FcgiMetrics &) = delete;
+  FcgiMetrics &operator=(const FcgiMetrics &) = delete;
+
+ public:
+  static FcgiMetrics *instance();
+
+  static long now_ns();
+
+ public:
+  void set_handler_sample_period(int);
+  int handler_sample_period() const;
+  // whether the calling thread is to time the request it starts handling
+  bool sample_handler();
+
+  void record_queue_wait(long ns);
+  void record_handler_time(long ns);
+  void record_connection_lifetime(long ms);
+  void add_bytes_in(long);
+  void add_bytes_out(long);
+  // counts of the records parsed, by type up to FCGI_MAXTYPE
+  void add_records(const long *nums);
+  void add_write_stall();
+
+  void collect(FcgiMetricsWriter &) const;
+  void reset();
+
+ private:
+  static const int RECORD_TYPE_NUM = 12;
+
+  int _handler_sample_period;
+  FcgiHistogram _queue_wait;
+  FcgiHistogram _handler_time;
+  FcgiHistogram _connection_lifetime;
+  FcgiCounter _bytes_in;
+  FcgiCounter _bytes_out;
+  FcgiCounter _record_nums[RECORD_TYPE_NUM];
+  FcgiCounter _write_stall_num;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef FCGI_PARAMS_H_
+#define FCGI_PARAMS_H_
+
+#include <stdint.h>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "fcgi_cgi.h"
+#include "fcgi_types.h"
+
+/*
+ * Name-value pairs of a request, in wire order.
+ *
+ * All names and values are copied back to back into one byte arena and
+ * referenced by offset, so filling the table costs a couple of allocations
+ * however many params arrive.  Lookups scan a flat array of entries,
+ * comparing a precomputed hash and the length before the bytes; a name sent
+ * more than once resolves to its last value.  Well-known CGI variables are
+ * also filed by CgiVar as they are added, and CONTENT_LENGTH is parsed.
+ */
+class FcgiParamTable {
+ public:
+  using Param = std::pair<std::string_view, std::string_view>;
+
+  class const_iterator {
+   public:
+    const_iterator(const FcgiParamTable *table, int idx)
+        : _table(table), _idx(idx) {}
+
+    Param operator*() const { return _table->at(_idx); }
+    const_iterator &operator++() {
+      ++_idx;
+      return *this;
+    }
+    bool operator==(const const_iterator &o) const { return _idx == o._idx; }
+    bool operator!=(const const_iterator &o) const { return _idx != o._idx; }
+
+   private:
+    const FcgiParamTable *_table;
+    int _idx;
+  };
+
+ public:
+  FcgiParamTable();
+
+ public:
+  void add(const ParamsVector &);
+  void add(std::string_view name, std::string_view value);
+  void clear();
+
+  std::optional<std::string_view> find(std::string_view name) const;
+  std::optional<std::string_view> known(CgiVar) const;
+  // -1 if CONTENT_LENGTH is missing or not a number
+  long content_length() const;
+
+  int size() const;
+  bool empty() const;
+  Param at(int idx) const;
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  static uint32_t hash(std::string_view);
+
+ private:
+  struct Entry {
+    uint32_t _hash;
+    uint32_t _name_off;
+    uint32_t _name_len;
+    uint32_t _value_len;
+  };
+
+  std::vector<char> _arena;
+  std::vector<Entry> _entries;
+  int _known[CGI_VAR_NUM];
+  long _content_length;
+};
+
+#endif
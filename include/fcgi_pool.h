@@ -0,0 +1,135 @@
+#ifndef FCGI_POOL_H_
+#define FCGI_POOL_H_
+
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "fcgi_counter.h"
+
+/*
+ * Recycles objects of type T, which must be default constructible and have a
+ * recycle() that resets one to its just constructed state while keeping what
+ * it has allocated.
+ *
+ * Like FcgiBufferPool, each thread keeps up to thread_cache_num objects and
+ * spills to (or refills from) a shared list of up to shared_num objects.
+ * trim() frees the shared objects nobody has asked for since the previous
+ * trim(), so a pool that goes idle shrinks back to the thread caches.
+ */
+template <typename T>
+class FcgiObjectPool {
+ private:
+  FcgiObjectPool(int thread_cache_num, int shared_num)
+      : _thread_cache_num(thread_cache_num),
+        _shared_num(shared_num),
+        _shared_low(0) {}
+  ~FcgiObjectPool() {
+    for (auto obj : _shared) delete obj;
+  }
+  FcgiObjectPool(const FcgiObjectPool &) = delete;
+  FcgiObjectPool &operator=(const FcgiObjectPool &) = delete;
+
+ public:
+  static FcgiObjectPool *instance();
+
+ public:
+  T *acquire() {
+    auto &free_list = thread_cache()._free;
+    T *obj = nullptr;
+    if (!free_list.empty()) {
+      obj = free_list.back();
+      free_list.pop_back();
+    } else {
+      obj = pop_shared();
+    }
+
+    if (obj != nullptr) {
+      _hit_num.add();
+      return obj;
+    }
+    _miss_num.add();
+    return new T;
+  }
+
+  void release(T *obj) {
+    if (obj == nullptr) return;
+
+    obj->recycle();
+    auto &free_list = thread_cache()._free;
+    if (int(free_list.size()) < _thread_cache_num) {
+      free_list.push_back(obj);
+    } else if (!push_shared(obj)) {
+      delete obj;
+    }
+  }
+
+  void trim() {
+    std::vector<T *> idle;
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      idle.assign(_shared.begin(), _shared.begin() + _shared_low);
+      _shared.erase(_shared.begin(), _shared.begin() + _shared_low);
+      _shared_low = _shared.size();
+    }
+    for (auto obj : idle) delete obj;
+    _trim_num.add(idle.size());
+  }
+
+  std::string statistics(const std::string &name) const {
+    std::ostringstream oss;
+    oss << name << "_pool_hit_num=" << _hit_num.load();
+    oss << " " << name << "_pool_miss_num=" << _miss_num.load();
+    oss << " " << name << "_pool_trim_num=" << _trim_num.load();
+    return oss.str();
+  }
+
+ private:
+  struct ThreadCache {
+    ~ThreadCache() {
+      for (auto obj : _free) {
+        if (!instance()->push_shared(obj)) delete obj;
+      }
+    }
+
+    std::vector<T *> _free;
+  };
+
+  static ThreadCache &thread_cache() {
+    static thread_local ThreadCache t_cache;
+    return t_cache;
+  }
+
+  bool push_shared(T *obj) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (_shared_num <= int(_shared.size())) return false;
+    _shared.push_back(obj);
+    return true;
+  }
+
+  T *pop_shared() {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (_shared.empty()) return nullptr;
+    T *obj = _shared.back();
+    _shared.pop_back();
+    _shared_low = std::min<int>(_shared_low, _shared.size());
+    return obj;
+  }
+
+ private:
+  const int _thread_cache_num;
+  const int _shared_num;
+
+  std::mutex _mutex;
+  // the objects at the bottom of _shared, up to _shared_low of them, have
+  // not been handed out since the last trim()
+  std::vector<T *> _shared;
+  int _shared_low;
+
+  FcgiCounter _hit_num;
+  FcgiCounter _miss_num;
+  FcgiCounter _trim_num;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef FCGI_QUEUE_H_
+#define FCGI_QUEUE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+class FcgiRequest;
+
+/*
+ * Bounded lock-free multi-producer/multi-consumer ring of requests.
+ *
+ * Producers never take a lock unless a consumer is parked.  pop_blocking()
+ * spins for spin_count() attempts before parking on a condition variable.
+ */
+class FcgiRequestQueue {
+ public:
+  explicit FcgiRequestQueue(int capacity);
+  virtual ~FcgiRequestQueue();
+  FcgiRequestQueue(const FcgiRequestQueue &) = delete;
+  FcgiRequestQueue &operator=(const FcgiRequestQueue &) = delete;
+
+ public:
+  int capacity() const;
+  // Requests waiting, approximate while others push or pop.
+  int size() const;
+  int spin_count() const;
+  void set_spin_count(int);
+
+  bool try_push(FcgiRequest *);
+  FcgiRequest *try_pop();
+  FcgiRequest *pop_blocking();
+
+ private:
+  void wake_up();
+
+ private:
+  struct alignas(64) Cell {
+    std::atomic_size_t _seq;
+    FcgiRequest *_req;
+  };
+
+  std::vector<Cell> _cells;
+  size_t _mask;
+  int _spin_count;
+
+  alignas(64) std::atomic_size_t _enqueue_pos;
+  alignas(64) std::atomic_size_t _dequeue_pos;
+  alignas(64) std::atomic_int _sleeper_num;
+
+  std::mutex _mutex;
+  std::condition_variable _cond;
+};
+
+#endif
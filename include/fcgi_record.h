@@ -2,8 +2,25 @@
 #define FCGI_RECORD_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <boost/asio/buffer.hpp>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
 #include "fcgi_types.h"
+class FcgiRingBuffer;
+
+// Header fields of one record, decoded once.
+struct FcgiRecordHead {
+  int complete_length() const;
+
+  uint8_t _version;
+  uint8_t _type;
+  uint8_t _padding_len;
+  uint16_t _request_id;
+  uint16_t _content_len;
+};
 
 class FcgiRecordReader {
  public:
@@ -13,11 +30,13 @@ class FcgiRecordReader {
   FcgiRecordReader &operator=(const FcgiRecordReader &) = delete;
 
  public:
+  // Decodes the headers of every complete record buffered from the current
+  // one on in a single pass; the accessors below then refer to the first of
+  // them until next_record() moves on.
+  int scan();
   bool can_read() const;
   int complete_length() const;
-  bool is_complete() const;
 
-  bool has_valid_head() const;
   int version() const;
   int type() const;
   int request_id() const;
@@ -31,16 +50,37 @@ class FcgiRecordReader {
   boost::asio::const_buffers_1 content() const;
 
  public:
-  boost::asio::mutable_buffers_1 buf() const;
+  // Room for the next read, taking a ring from the pool if there is none.
+  boost::asio::mutable_buffers_1 buf();
   bool buf_full() const;
+  bool grow();
   void next_record();
   void clear_complete_record();
   void transferred(int);
+  // drops whatever is buffered and gives the ring back
+  void clear();
+
+ public:
+  static int decode_heads(const char *buf, int len,
+                          std::vector<FcgiRecordHead> &);
+  static void decode_params(const char *content, int len, ParamsVector &);
 
  private:
+  int space() const;
+  void acquire_ring();
+  void release_ring();
+
+ private:
+  // Records are read into a mirrored ring and parsed in place, wrapped or
+  // not; _buf and _cap cache its mapping.  The ring starts at the smallest
+  // size, grows for a record that does not fit and drops back once empty.
+  FcgiRingBuffer *_ring;
   char *_buf;
+  int _cap;
   int _len;
   int _idx;
+  std::vector<FcgiRecordHead> _heads;
+  int _cur;
 };
 
 class FcgiRecordWriter {
@@ -51,12 +91,25 @@ class FcgiRecordWriter {
   FcgiRecordWriter &operator=(const FcgiRecordWriter &) = delete;
 
  public:
-  boost::asio::const_buffers_1 buf() const;
+  std::vector<boost::asio::const_buffer> buf() const;
+  // Whether the next bytes to send are len bytes of fd at offset, which
+  // buf() leaves to the caller to send kernel-side.
+  bool file_pending(int *fd, off_t *offset, int *len) const;
   bool buf_empty() const;
-  void transferred(int);
+  // drops whatever is queued, as if it could not be sent
+  void clear();
+  // bytes queued but not yet sent, caller owned buffers included
+  long pending_length() const;
+  void transferred(int, std::vector<FcgiWriteCallback> &finished);
   bool stdout(int request_id, boost::asio::const_buffers_1 &);
+  bool stdout(int request_id, const boost::asio::const_buffer &,
+              std::shared_ptr<const void> owner, FcgiWriteCallback);
+  bool stdout_file(int request_id, int fd, off_t offset, size_t len,
+                   std::shared_ptr<const void> owner, FcgiWriteCallback);
   bool end_stdout(int request_id);
   bool reply(int request_id, uint32_t code);
+  bool reply(int request_id, uint32_t code, uint8_t protocol_status);
+  bool get_values_result(const ParamsMap &);
 
  private:
   void set_version(int);
@@ -64,20 +117,52 @@ class FcgiRecordWriter {
   void set_request_id(int);
   void set_content_length(int);
   void set_content(boost::asio::const_buffers_1 &);
+  void set_name_value(const std::string &name, const std::string &value);
   void set_padding(int);
   void set_app_status(uint32_t);
   void set_protocol_status(int);
 
-  bool can_write(int len) const;
+  int room() const;
+  bool can_write(int len);
   void next_record();
+  void append_internal(int len);
+  void sent_internal(int len);
 
   int complete_length() const;
   int content_length() const;
   int padding_length() const;
 
  private:
-  char *_buf;
-  int _len;
+  // Pooled chunks holding the records framed here, in send order.  The next
+  // record is framed at _next in the last one and a chunk goes back to the
+  // pool as soon as all of its bytes have been sent.
+  struct Chunk {
+    char *_buf;
+    int _cap;
+    int _len;
+    int _sent;
+  };
+  std::deque<Chunk> _chunks;
+  char *_next;
+  long _pending_len;
+
+  // Output in send order.  An _internal segment points into one of _chunks,
+  // a segment with an _fd covers _len bytes of that file from _offset on,
+  // and any other segment points into a caller owned buffer.  _owner keeps
+  // the buffer or file alive until it has been sent.
+  struct Segment {
+    const char *_data;
+    int _len;
+    std::shared_ptr<const void> _owner;
+    FcgiWriteCallback _callback;
+    bool _internal;
+    int _fd;
+    off_t _offset;
+  };
+  bool frame_stdout(int request_id, const Segment &body, size_t len,
+                    FcgiWriteCallback);
+
+  std::deque<Segment> _segments;
 };
 
 #endif
@@ -2,9 +2,16 @@
 #define FCGI_REQUEST_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <boost/asio/buffer.hpp>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include "fcgi_cancel.h"
+#include "fcgi_params.h"
+#include "fcgi_pool.h"
+#include "fcgi_stdin.h"
 #include "fcgi_types.h"
 class FcgiConnection;
 
@@ -16,25 +23,95 @@ class FcgiRequest {
   FcgiRequest &operator=(const FcgiRequest &) = delete;
 
  public:
+  // Requests come from and go back to FcgiObjectPool<FcgiRequest>; see
+  // FcgiApp::free_request().
+  static FcgiRequest *create();
+  void recycle();
+
   int request_id() const;
   void set_request_id(int);
   int role() const;
   void set_role(int);
   int flags() const;
   void set_flags(int);
-  const ParamsMap &params() const;
+  // A copy of every param, built on each call; param() and param_table()
+  // do without.
+  ParamsMap params() const;
+  const FcgiParamTable &param_table() const;
   void add_params(const ParamsVector &);
+  // The view stays valid as long as the request.
+  std::optional<std::string_view> param(std::string_view name) const;
+  std::optional<std::string_view> known(CgiVar) const;
+  long content_length() const;
   bool get_param(const char *name, std::string &value) const;
   bool get_param(const std::string &name, std::string &value) const;
+  // Only filled when the body is not streamed.
   const std::string &stdin() const;
   void add_stdin_data(const boost::asio::const_buffer &);
 
+  // Streamed stdin, see FcgiApp::set_stdin_streaming().  read_stdin() blocks
+  // for the next chunk and returns false at the end of the body; on_stdin()
+  // pushes the chunks to handler on the io thread instead.  Use one or the
+  // other.  Without streaming both just deliver stdin() as one chunk.
+  // read_stdin() must not be called from an io thread, which alone reads
+  // the chunks it would wait for: there it returns false, with
+  // stdin_complete() false, rather than block.
+  bool stdin_streaming() const;
+  bool read_stdin(std::string &chunk);
+  void on_stdin(FcgiStdinHandler handler);
+  // false if the connection was lost before the whole body arrived
+  bool stdin_complete() const;
+  void set_stdin_stream(std::shared_ptr<FcgiStdinStream>);
+
   void set_connection(std::weak_ptr<FcgiConnection>);
 
+  // True once FCGI_ABORT_REQUEST arrived for the request or its connection
+  // was lost, so that nobody waits for the response any more.  on_cancel()
+  // callbacks run on the io thread that notices, or right away if the
+  // request is cancelled already.  A request cancelled while in the queue is
+  // dropped before it is popped.
+  bool cancelled() const;
+  void on_cancel(FcgiCancelCallback);
+  std::shared_ptr<FcgiCancelToken> cancel_token() const;
+  // In FcgiMetrics::now_ns(): when FcgiApp pushed the request to its queue,
+  // and when a handler started on it, or 0 if that is not timed.
+  long queued_ns() const;
+  void set_queued_ns(long);
+  long started_ns() const;
+  void set_started_ns(long);
+
+  // Copies the bytes.  Output is never refused for its size: the connection
+  // frames it into as many pooled chunks as it takes, so a producer of large
+  // responses should pace itself with the calls below.
   bool stdout(boost::asio::const_buffers_1 &);
   bool stdout(const std::string &);
+
+  // Zero-copy variants: the bytes are framed in place and sent straight from
+  // the given buffer, which is kept alive until callback has been invoked.
+  bool stdout(std::string &&, FcgiWriteCallback = nullptr);
+  bool stdout(std::shared_ptr<const std::string>, FcgiWriteCallback = nullptr);
+  bool stdout(const boost::asio::const_buffer &,
+              std::shared_ptr<const void> owner, FcgiWriteCallback = nullptr);
+  // Sends len bytes of fd from offset with sendfile(), so they never enter
+  // user space.  fd must stay open, and the bytes unchanged, until callback
+  // has been invoked; owner, if any, is released at the same time.
+  bool stdout_file(int fd, off_t offset, size_t len,
+                   FcgiWriteCallback = nullptr,
+                   std::shared_ptr<const void> owner = nullptr);
   bool end_stdout();
   bool reply(uint32_t code);
+  // Ends the request with FCGI_OVERLOADED rather than a response.
+  bool reject();
+
+  // Flow control against FcgiApp::set_write_watermarks().  writable() is
+  // false while the connection holds more than the high watermark of unsent
+  // output.  on_writable() calls back, possibly right away, once it is down
+  // to the low watermark, and with false if the connection is gone.
+  // wait_writable() blocks for the same and must not be called from an io
+  // thread.
+  bool writable() const;
+  void on_writable(FcgiWriteCallback);
+  bool wait_writable();
 
  private:
   std::weak_ptr<FcgiConnection> _conn;
@@ -42,8 +119,16 @@ class FcgiRequest {
   int _role;
   int _flags;
 
-  ParamsMap _params;
+  FcgiParamTable _params;
   std::string _stdin;
+  std::shared_ptr<FcgiStdinStream> _stdin_stream;
+  bool _stdin_read;
+  std::shared_ptr<FcgiCancelToken> _cancel_token;
+  long _queued_ns;
+  long _started_ns;
 };
 
+template <>
+FcgiObjectPool<FcgiRequest> *FcgiObjectPool<FcgiRequest>::instance();
+
 #endif
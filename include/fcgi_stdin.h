@@ -0,0 +1,69 @@
+#ifndef FCGI_STDIN_H_
+#define FCGI_STDIN_H_
+
+#include <boost/asio/buffer.hpp>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class FcgiConnection;
+
+// Receives stdin chunks in order, then ({}, true) once the body is over.  The
+// buffer may point straight into the connection's read buffer and is only
+// valid during the call.
+using FcgiStdinHandler =
+    std::function<void(const boost::asio::const_buffer &, bool end)>;
+
+/*
+ * Body of a request that was dispatched before its stdin had arrived.
+ *
+ * The connection pushes STDIN records into it as they are parsed; the
+ * handler either registers a FcgiStdinHandler or pulls chunks with read(),
+ * not both.  The stream is shared by the request and the connection so that
+ * neither has to outlive the other.  Once more than a high watermark of
+ * chunks waits to be consumed the connection stops reading, and it resumes
+ * when the backlog falls under the low watermark.
+ */
+class FcgiStdinStream : public std::enable_shared_from_this<FcgiStdinStream> {
+ public:
+  explicit FcgiStdinStream(std::weak_ptr<FcgiConnection>);
+  FcgiStdinStream(const FcgiStdinStream &) = delete;
+  FcgiStdinStream &operator=(const FcgiStdinStream &) = delete;
+
+ public:
+  // connection side
+  void push(const boost::asio::const_buffer &);
+  void end(bool complete);
+  bool backlogged() const;
+
+  // request side
+  void set_handler(FcgiStdinHandler);
+  // false at the end of the body, or right away if nothing is queued and
+  // block is false
+  bool read(std::string &chunk, bool block = true);
+  bool complete() const;
+  void discard();
+
+ private:
+  void deliver(std::unique_lock<std::mutex> &);
+  void resume_connection();
+
+ private:
+  std::weak_ptr<FcgiConnection> _conn;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _cond;
+  std::deque<std::string> _chunks;
+  size_t _queued_len;
+  FcgiStdinHandler _handler;
+  bool _delivering;
+  bool _ended;
+  bool _end_delivered;
+  bool _complete;
+  bool _discarded;
+};
+
+#endif
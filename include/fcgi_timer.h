@@ -0,0 +1,70 @@
+#ifndef FCGI_TIMER_H_
+#define FCGI_TIMER_H_
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <climits>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "fcgi_counter.h"
+class FcgiConnection;
+
+// What a connection was reaped for.
+enum class FcgiTimeout { Idle, Params, Stdin, Write };
+
+/*
+ * Hashed timer wheel reaping the connections of one io_service, so that
+ * timeouts cost a slot entry per connection rather than a steady_timer.
+ *
+ * Times are milliseconds since the wheel started, as of its last tick: now()
+ * is as coarse as the tick and cheap enough to read on every io.  A
+ * connection is scheduled for the earliest of its deadlines and re-checks
+ * them when its slot comes up, so moving a deadline later costs nothing.
+ * Only an earlier deadline needs schedule() again; the entry it replaces is
+ * recognized as stale and dropped.
+ */
+class FcgiTimerWheel {
+ public:
+  FcgiTimerWheel(boost::asio::io_service &, std::chrono::milliseconds tick,
+                 int slot_num);
+  virtual ~FcgiTimerWheel();
+  FcgiTimerWheel(const FcgiTimerWheel &) = delete;
+  FcgiTimerWheel &operator=(const FcgiTimerWheel &) = delete;
+
+ public:
+  static const long NEVER = LONG_MAX;
+
+  void start();
+  long now() const;
+  void schedule(std::weak_ptr<FcgiConnection>, long when);
+
+  void expired(FcgiTimeout);
+  long expired_num(FcgiTimeout) const;
+
+ private:
+  struct Entry {
+    std::weak_ptr<FcgiConnection> _conn;
+    long _when;
+  };
+
+  void add(Entry &&);
+  void post_tick();
+  void tick();
+  long elapsed() const;
+
+ private:
+  boost::asio::steady_timer _timer;
+  const std::chrono::steady_clock::time_point _epoch;
+  const long _tick_ms;
+  std::atomic_long _now;
+
+  std::mutex _mutex;
+  // tick of the next slot to run
+  long _next_tick;
+  std::vector<std::vector<Entry>> _slots;
+
+  FcgiCounter _expired_nums[4];
+};
+
+#endif
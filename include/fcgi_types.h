@@ -1,7 +1,10 @@
 #ifndef FCGI_TYPES_H_
 #define FCGI_TYPES_H_
 
+#include <functional>
 #include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
 struct FcgiParam {
@@ -19,4 +22,8 @@ using ParamsVector = std::vector<FcgiParam>;
 
 using ParamsMap = std::map<std::string, std::string>;
 
+// Invoked once the bytes of a zero-copy stdout call have been handed to the
+// socket (true) or dropped because the connection went away (false).
+using FcgiWriteCallback = std::function<void(bool)>;
+
 #endif
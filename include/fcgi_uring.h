@@ -0,0 +1,103 @@
+#ifndef FCGI_URING_H_
+#define FCGI_URING_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <boost/asio.hpp>
+#include <functional>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#include "fcgi_counter.h"
+
+// Result of one io_uring operation: res is what the equivalent syscall would
+// have returned, or -errno.  IORING_CQE_F_MORE in flags means a multishot
+// operation keeps going and will complete again.
+using FcgiUringCompletion = std::function<void(int res, unsigned flags)>;
+
+/*
+ * Minimal io_uring driven from an io_service, talking to the kernel through
+ * the raw syscalls so that neither liburing nor asio's own (compile-time)
+ * io_uring backend is needed.
+ *
+ * Operations queued while the io_service runs handlers are submitted
+ * together by a single io_uring_enter() once those handlers are done.
+ * Completions signal an eventfd the io_service waits on, and are reaped in
+ * batches as well.  Completion handlers run on the io_service's threads.
+ * Any thread may queue operations.
+ */
+class FcgiUring {
+ public:
+  explicit FcgiUring(boost::asio::io_service &);
+  virtual ~FcgiUring();
+  FcgiUring(const FcgiUring &) = delete;
+  FcgiUring &operator=(const FcgiUring &) = delete;
+
+ public:
+  // false if the kernel, or a system other than Linux, has no io_uring
+  bool open(unsigned entries);
+
+  void recv(int fd, void *buf, unsigned len, FcgiUringCompletion);
+  // msg and what it points to must stay untouched until completion
+  void sendmsg(int fd, const msghdr *msg, FcgiUringCompletion);
+  void poll(int fd, unsigned events, FcgiUringCompletion);
+  // Multishot: completes once per accepted socket, which is non-blocking.
+  void accept(int fd, FcgiUringCompletion);
+
+  // whether a multishot operation completing with these flags goes on
+  static bool more(unsigned flags);
+
+  long enter_num() const;
+  long submit_num() const;
+  long complete_num() const;
+
+ private:
+  struct Op {
+    FcgiUringCompletion _completion;
+  };
+
+  void queue(uint8_t opcode, int fd, uint64_t addr, unsigned len,
+             uint32_t op_flags, uint16_t ioprio, FcgiUringCompletion);
+  void *get_sqe();
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+  void post_flush();
+  void flush();
+  void post_wait();
+  void reap();
+  void cancel_all();
+
+ private:
+  boost::asio::io_service &_io;
+  boost::asio::posix::stream_descriptor _event;
+  uint64_t _event_count;
+  int _fd;
+
+  void *_sq_ring;
+  size_t _sq_ring_len;
+  void *_cq_ring;
+  size_t _cq_ring_len;
+  void *_sqes;
+  size_t _sqes_len;
+
+  unsigned *_sq_head;
+  unsigned *_sq_tail;
+  unsigned *_sq_mask;
+  unsigned *_sq_array;
+  unsigned *_sq_flags;
+  unsigned _sq_entries;
+  unsigned *_cq_head;
+  unsigned *_cq_tail;
+  unsigned *_cq_mask;
+  void *_cqes;
+
+  std::mutex _mutex;
+  unsigned _unsubmitted;
+  bool _flush_posted;
+  std::unordered_set<Op *> _pending;
+
+  FcgiCounter _enter_num;
+  FcgiCounter _submit_num;
+  FcgiCounter _complete_num;
+};
+
+#endif
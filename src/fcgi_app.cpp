@@ -1,106 +1,480 @@
 #include "fcgi_app.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <algorithm>
 #include <functional>
 #include <iterator>
 #include <memory>
 #include <sstream>
+#include "fcgi_buffer.h"
 #include "fcgi_connection.h"
+#include "fcgi_metrics.h"
 #include "fcgi_protocol.h"
 #include "fcgi_request.h"
+#include "fcgi_timer.h"
+#include "fcgi_uring.h"
 using namespace std::placeholders;
 using namespace boost::asio;
 using namespace boost::asio::ip;
+using boost::asio::generic::stream_protocol;
 using namespace boost::system;
 
 FcgiApp *FcgiApp::s_app = nullptr;
+static thread_local bool s_in_io_thread = false;
+
+// seconds between two trims of the request and connection pools
+static const int FCGI_POOL_TRIM_INTERVAL = 10;
+static const int FCGI_URING_ENTRIES = 1024;
+// the timer wheels turn once every 256 seconds
+static const int FCGI_TIMER_TICK_MS = 250;
+static const int FCGI_TIMER_SLOT_NUM = 1024;
 
 FcgiApp::FcgiApp()
-    : _acceptor(nullptr),
+    : _sharded(false),
+      _io_uring(false),
+      _stdin_streaming(false),
+      _write_high_watermark(1024 * 1024),
+      _write_low_watermark(1024 * 256),
+      _next_shard(0),
+      _queue(new FcgiRequestQueue(1024 * 64)),
+      _max_conns(0),
+      _max_reqs(0),
+      _overload_queue_depth(0),
+      _overload_queue_wait_us(0),
+      _queue_wait_us(0),
       _thread_num(1),
-      _dequeue_req_num(0),
-      _enqueue_req_num(0),
-      _connection_num(0) {}
+      _connection_num(0),
+      _request_num(0) {}
 
 FcgiApp::~FcgiApp() {
-  _acceptor->close();
-  _io_service.stop();
+  for (auto &io : _io_services) io->stop();
   std::for_each(std::begin(_io_thread_group), std::end(_io_thread_group),
                 [](auto &t) { t.join(); });
-  delete _acceptor;
-  while (!_queue.empty()) {
-    auto req = _queue.front();
-    _queue.pop();
-    delete req;
-  }
+  // cancels what is in flight before the connections' io_services go, and
+  // before the acceptors, whose sockets a pending accept keeps listening
+  _urings.clear();
+  for (auto &a : _acceptors) delete a->_acceptor;
+  _acceptors.clear();
+  _trim_timer.reset();
+  _wheels.clear();
+  _work_guards.clear();
+  // destroys the handlers still pending, and the connections bound to them,
+  // while the rest of the app is alive.
+  _io_services.clear();
+
+  FcgiRequest *req = nullptr;
+  while ((req = _queue->try_pop()) != nullptr) free_request(req);
+  delete _queue;
 }
 
 void FcgiApp::new_instance() { s_app = new FcgiApp; }
 void FcgiApp::delete_instance() { delete s_app; }
 FcgiApp *FcgiApp::instance() { return s_app; }
+bool FcgiApp::in_io_thread() { return s_in_io_thread; }
+
+static bool IsTcp(int family) {
+  return family == AF_INET || family == AF_INET6;
+}
+
+void FcgiApp::open_acceptor(const Listener &l, int shard) {
+  using reuse_port =
+      boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
 
-void FcgiApp::post_async_accept() {
-  auto sock = new tcp::socket(_io_service);
-  _acceptor->async_accept(*sock,
-                          std::bind(&FcgiApp::accept_handler, this, sock, _1));
+  auto acceptor = new FcgiAcceptor(*_io_services[std::max(0, shard)]);
+  if (0 <= l._fd) {
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    addr.ss_family = AF_INET;
+    getsockname(l._fd, (sockaddr *)&addr, &len);
+    acceptor->assign(stream_protocol(addr.ss_family, 0), l._fd);
+  } else {
+    const int family = l._endpoint.protocol().family();
+    acceptor->open(l._endpoint.protocol());
+    if (IsTcp(family)) {
+      acceptor->set_option(socket_base::reuse_address(true));
+      if (_sharded) acceptor->set_option(reuse_port(true));
+    }
+    acceptor->bind(l._endpoint);
+    acceptor->listen(l._options.backlog);
+  }
+  _acceptors.emplace_back(new Acceptor{acceptor, shard, l._options, true});
+}
+
+int FcgiApp::next_shard(const Acceptor *a) {
+  if (0 <= a->_shard) return a->_shard;
+  return _next_shard.fetch_add(1, std::memory_order_relaxed) %
+         _io_services.size();
+}
+
+static void SetAcceptedOptions(int fd, const FcgiListenOptions &o) {
+  if (0 <= o.linger) {
+    struct linger l = {1, o.linger};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+  }
+  if (o.tcp_nodelay) {
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (sockaddr *)&addr, &len) == 0 &&
+        IsTcp(addr.ss_family)) {
+      int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+  }
+  if (0 < o.recv_buffer_size) {
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &o.recv_buffer_size,
+               sizeof(o.recv_buffer_size));
+  }
+  if (0 < o.send_buffer_size) {
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &o.send_buffer_size,
+               sizeof(o.send_buffer_size));
+  }
+}
+
+bool FcgiApp::admit_connection() {
+  const int n = _connection_num.fetch_add(1, std::memory_order_relaxed);
+  if (0 < _max_conns && _max_conns <= n) {
+    _connection_num.fetch_sub(1, std::memory_order_relaxed);
+    _rejected_conn_num.add();
+    return false;
+  }
+  return true;
+}
+
+void FcgiApp::post_async_accept(Acceptor *a) {
+  if (!_urings.empty() && a->_uring_accept) {
+    const int shard = std::max(0, a->_shard);
+    _urings[shard]->accept(
+        a->_acceptor->native_handle(),
+        std::bind(&FcgiApp::uring_accept_handler, this, a, _1, _2));
+    return;
+  }
+
+  // owned by the handler, so it goes with it even if the handler never runs,
+  // as when the io_services are destroyed with the accept pending
+  const int shard = next_shard(a);
+  std::unique_ptr<FcgiSocket> sock(new FcgiSocket(*_io_services[shard]));
+  FcgiSocket &peer = *sock;
+  a->_acceptor->async_accept(
+      peer, [this, a, shard, sock = std::move(sock)](
+                const error_code &rc) mutable {
+        accept_handler(a, std::move(sock), shard, rc);
+      });
+}
+
+void FcgiApp::accept_handler(Acceptor *a, std::unique_ptr<FcgiSocket> sock,
+                             int shard, const error_code &rc) {
+  if (rc == error::operation_aborted) return;
+
+  if (!rc && !admit_connection()) {
+    error_code ec;
+    sock->close(ec);
+  } else if (!rc) {
+    SetAcceptedOptions(sock->native_handle(), a->_options);
+    auto conn = FcgiConnection::create(sock.release());
+    conn->start_timer(_wheels[shard].get());
+    conn->post_async_read();
+  }
+  post_async_accept(a);
 }
 
-void FcgiApp::accept_handler(tcp::socket *sock, const error_code &rc) {
-  if (!rc) {
-    socket_base::linger option(true, 30);
-    sock->set_option(option);
+// One multishot accept keeps delivering sockets until the kernel ends it,
+// and is then armed again.
+void FcgiApp::uring_accept_handler(Acceptor *a, int res, unsigned flags) {
+  if (res == -ECANCELED) return;
+  if (res == -EINVAL) {
+    a->_uring_accept = false;
+    post_async_accept(a);
+    return;
+  }
 
-    auto conn = std::make_shared<FcgiConnection>(sock);
+  if (0 <= res && !admit_connection()) {
+    ::close(res);
+  } else if (0 <= res) {
+    SetAcceptedOptions(res, a->_options);
+    const int shard = next_shard(a);
+    auto conn = FcgiConnection::create(res, _urings[shard].get());
+    conn->start_timer(_wheels[shard].get());
     conn->post_async_read();
-    _connection_num.fetch_add(1, std::memory_order_relaxed);
   }
-  post_async_accept();
+  if (!FcgiUring::more(flags)) post_async_accept(a);
+}
+
+void FcgiApp::post_trim_pools() {
+  _trim_timer->expires_after(std::chrono::seconds(FCGI_POOL_TRIM_INTERVAL));
+  _trim_timer->async_wait([this](const error_code &rc) {
+    if (rc == error::operation_aborted) return;
+    FcgiObjectPool<FcgiRequest>::instance()->trim();
+    FcgiObjectPool<FcgiConnection>::instance()->trim();
+    FcgiRingPool::instance()->trim();
+    post_trim_pools();
+  });
+}
+
+void FcgiApp::io_function(int shard) {
+  s_in_io_thread = true;
+#ifdef __linux__
+  if (_sharded) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(shard % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+#endif
+  _io_services[_sharded ? shard : 0]->run();
 }
 
-void FcgiApp::io_function() { _io_service.run(); }
+// Ends a request cancelled while it waited in the queue.  The reply only
+// goes out if it was aborted; a lost connection takes nothing any more.
+bool FcgiApp::drop_cancelled(FcgiRequest *req) {
+  if (!req->cancelled()) return false;
+  _cancelled_req_num.add();
+  req->reply(0);
+  free_request(req);
+  return true;
+}
+
+// Accounts for a request taken off the queue, false if it has been dropped
+// instead of being handed out.  The handler is timed from here, not from an
+// earlier dispatch.
+bool FcgiApp::dequeued(FcgiRequest *req) {
+  _dequeue_req_num.add();
+  auto metrics = FcgiMetrics::instance();
+  const long now = FcgiMetrics::now_ns();
+  const long wait = now - req->queued_ns();
+  _queue_wait_us.store(wait / 1000, std::memory_order_relaxed);
+  metrics->record_queue_wait(wait);
+  if (drop_cancelled(req)) return false;
+  req->set_started_ns(metrics->sample_handler() ? now : 0);
+  return true;
+}
 
 FcgiRequest *FcgiApp::pop_request_blocking() {
-  FcgiRequest *req = nullptr;
-  std::unique_lock<std::mutex> guard(_mutex);
-  while (_queue.empty()) {
-    _cond.wait(guard);
+  for (;;) {
+    FcgiRequest *req = _queue->pop_blocking();
+    if (dequeued(req)) return req;
   }
-  req = _queue.front();
-  _queue.pop();
-  ++_dequeue_req_num;
-  return req;
 }
 
 FcgiRequest *FcgiApp::pop_request_nonblocking() {
   FcgiRequest *req = nullptr;
-  std::unique_lock<std::mutex> guard(_mutex);
-  if (!_queue.empty()) {
-    req = _queue.front();
-    _queue.pop();
-    ++_dequeue_req_num;
+  while ((req = _queue->try_pop()) != nullptr) {
+    if (dequeued(req)) break;
   }
   return req;
 }
 
-void FcgiApp::push_request(FcgiRequest *req) {
-  {
-    std::unique_lock<std::mutex> guard(_mutex);
-    _queue.push(req);
-    ++_enqueue_req_num;
+bool FcgiApp::push_request(FcgiRequest *req) {
+  req->set_queued_ns(FcgiMetrics::now_ns());
+  if (!_queue->try_push(req)) return false;
+  _enqueue_req_num.add();
+  return true;
+}
+
+// A request admitted while the queue was short may find it congested by the
+// time its body is complete, or even full, which the io thread must not wait
+// out.
+void FcgiApp::dispatch_request(FcgiRequest *req) {
+  if (overloaded()) {
+    reject_request(req);
+    return;
+  }
+
+  if (FcgiMetrics::instance()->sample_handler())
+    req->set_started_ns(FcgiMetrics::now_ns());
+  if (_async_handler) {
+    _inline_req_num.add();
+    _async_handler(req);
+  } else if (_handler && _handler(*req)) {
+    _inline_req_num.add();
+    free_request(req);
+  } else if (!push_request(req)) {
+    reject_request(req);
   }
-  _cond.notify_one();
 }
 
-void FcgiApp::free_request(FcgiRequest *req) { delete req; }
+// Answers FCGI_OVERLOADED for a request that is not handled, nor timed.
+void FcgiApp::reject_request(FcgiRequest *req) {
+  _rejected_req_num.add();
+  req->set_started_ns(0);
+  req->reject();
+  free_request(req);
+}
 
-void FcgiApp::start(int thread_num) {
-  _acceptor = new tcp::acceptor(_io_service, tcp::v4(), FCGI_LISTENSOCK_FILENO);
-  post_async_accept();
+void FcgiApp::free_request(FcgiRequest *req) {
+  if (req->started_ns() != 0) {
+    FcgiMetrics::instance()->record_handler_time(FcgiMetrics::now_ns() -
+                                                 req->started_ns());
+  }
+  FcgiObjectPool<FcgiRequest>::instance()->release(req);
+  _request_num.fetch_sub(1, std::memory_order_relaxed);
+}
 
+void FcgiApp::start(int thread_num) {
   _thread_num = thread_num;
+  const int shard_num = _sharded ? _thread_num : 1;
+  for (int i = 0; i < shard_num; ++i) {
+    _io_services.emplace_back(new io_service(_sharded ? 1 : _thread_num));
+    _work_guards.emplace_back(make_work_guard(*_io_services.back()));
+  }
+
+  if (_io_uring) {
+    for (auto &io : _io_services) {
+      _urings.emplace_back(new FcgiUring(*io));
+      if (!_urings.back()->open(FCGI_URING_ENTRIES)) {
+        _urings.clear();
+        break;
+      }
+    }
+  }
+
+  for (auto &io : _io_services) {
+    _wheels.emplace_back(new FcgiTimerWheel(
+        *io, std::chrono::milliseconds(FCGI_TIMER_TICK_MS),
+        FCGI_TIMER_SLOT_NUM));
+    _wheels.back()->start();
+  }
+
+  if (_listeners.empty()) listen_fd(FCGI_LISTENSOCK_FILENO);
+  for (auto &l : _listeners) {
+    if (_sharded && l._fd < 0 && IsTcp(l._endpoint.protocol().family())) {
+      for (int i = 0; i < shard_num; ++i) open_acceptor(l, i);
+    } else {
+      open_acceptor(l, -1);
+    }
+  }
+  for (auto &a : _acceptors) post_async_accept(a.get());
+  _trim_timer.reset(new steady_timer(*_io_services[0]));
+  post_trim_pools();
+
+  int shard = 0;
   std::generate_n(
       std::back_insert_iterator<decltype(_io_thread_group)>(_io_thread_group),
-      _thread_num,
-      [this]() { return std::thread(&FcgiApp::io_function, this); });
+      _thread_num, [this, &shard]() {
+        return std::thread(&FcgiApp::io_function, this, shard++);
+      });
+}
+
+void FcgiApp::set_sharded(bool sharded) { _sharded = sharded; }
+
+void FcgiApp::set_io_uring(bool io_uring) { _io_uring = io_uring; }
+
+bool FcgiApp::io_uring() const { return !_urings.empty(); }
+
+void FcgiApp::set_stdin_streaming(bool streaming) {
+  _stdin_streaming = streaming;
+}
+
+bool FcgiApp::stdin_streaming() const { return _stdin_streaming; }
+
+void FcgiApp::set_write_watermarks(long high, long low) {
+  _write_high_watermark = high;
+  _write_low_watermark = std::min(low, high);
+}
+
+long FcgiApp::write_high_watermark() const { return _write_high_watermark; }
+
+long FcgiApp::write_low_watermark() const { return _write_low_watermark; }
+
+void FcgiApp::set_timeouts(const FcgiTimeouts &timeouts) {
+  _timeouts = timeouts;
+}
+
+const FcgiTimeouts &FcgiApp::timeouts() const { return _timeouts; }
+
+void FcgiApp::listen(const std::string &host, unsigned short port,
+                     const FcgiListenOptions &options) {
+  io_service io;
+  tcp::resolver resolver(io);
+  auto results = resolver.resolve(host, std::to_string(port),
+                                  tcp::resolver::passive);
+  for (auto &r : results) {
+    _listeners.push_back(Listener{r.endpoint(), -1, options});
+  }
+}
+
+void FcgiApp::listen_unix(const std::string &path,
+                          const FcgiListenOptions &options) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    ::unlink(path.c_str());
+  _listeners.push_back(
+      Listener{local::stream_protocol::endpoint(path), -1, options});
+}
+
+void FcgiApp::listen_fd(int fd, const FcgiListenOptions &options) {
+  _listeners.push_back(Listener{stream_protocol::endpoint(), fd, options});
+}
+
+bool FcgiApp::get_value(const std::string &name, std::string &value) const {
+  if (name == FCGI_MPXS_CONNS) {
+    value = "1";
+    return true;
+  }
+  if (name == FCGI_MAX_CONNS && 0 < _max_conns) {
+    value = std::to_string(_max_conns);
+    return true;
+  }
+  if (name == FCGI_MAX_REQS && 0 < _max_reqs) {
+    value = std::to_string(_max_reqs);
+    return true;
+  }
+  return false;
+}
+
+void FcgiApp::set_max_conns(int max_conns) { _max_conns = max_conns; }
+
+void FcgiApp::set_max_reqs(int max_reqs) { _max_reqs = max_reqs; }
+
+void FcgiApp::set_overload_thresholds(int queue_depth,
+                                      std::chrono::milliseconds queue_wait) {
+  _overload_queue_depth = queue_depth;
+  _overload_queue_wait_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(queue_wait)
+          .count();
+}
+
+// The last wait only counts while the queue is not empty, it would go stale
+// otherwise.
+bool FcgiApp::overloaded() const {
+  const int depth = _queue->size();
+  if (0 < _overload_queue_depth && _overload_queue_depth <= depth) return true;
+  return 0 < _overload_queue_wait_us && 0 < depth &&
+         _overload_queue_wait_us <=
+             _queue_wait_us.load(std::memory_order_relaxed);
+}
+
+bool FcgiApp::admit_request() {
+  const int n = _request_num.fetch_add(1, std::memory_order_relaxed);
+  if ((0 < _max_reqs && _max_reqs <= n) || overloaded()) {
+    _request_num.fetch_sub(1, std::memory_order_relaxed);
+    _rejected_req_num.add();
+    return false;
+  }
+  return true;
+}
+
+void FcgiApp::set_queue_capacity(int capacity) {
+  const int spin_count = _queue->spin_count();
+  delete _queue;
+  _queue = new FcgiRequestQueue(capacity);
+  _queue->set_spin_count(spin_count);
+}
+
+void FcgiApp::set_queue_spin_count(int spin_count) {
+  _queue->set_spin_count(spin_count);
+}
+
+void FcgiApp::set_request_handler(FcgiRequestHandler handler) {
+  _handler = std::move(handler);
+}
+
+void FcgiApp::set_async_request_handler(FcgiAsyncRequestHandler handler) {
+  _async_handler = std::move(handler);
 }
 
 void FcgiApp::decrease_connection_num() {
@@ -108,16 +482,102 @@ void FcgiApp::decrease_connection_num() {
 }
 
 void FcgiApp::reset_statistics() {
-  std::unique_lock<std::mutex> guard(_mutex);
-  _enqueue_req_num = 0;
-  _dequeue_req_num = 0;
+  _enqueue_req_num.reset();
+  _dequeue_req_num.reset();
+  _inline_req_num.reset();
+  _rejected_conn_num.reset();
+  _rejected_req_num.reset();
+  _cancelled_req_num.reset();
+  FcgiMetrics::instance()->reset();
 }
 
 std::string FcgiApp::statistics() const {
   std::ostringstream oss;
   oss << "thread_num=" << _thread_num;
+  oss << " shard_num=" << _io_services.size();
+  oss << " io_uring=" << io_uring();
   oss << " connection_num=" << _connection_num.load(std::memory_order_relaxed);
-  oss << " enqueue_num=" << _enqueue_req_num;
-  oss << " dequeue_num=" << _dequeue_req_num;
+  oss << " enqueue_num=" << _enqueue_req_num.load();
+  oss << " dequeue_num=" << _dequeue_req_num.load();
+  oss << " inline_num=" << _inline_req_num.load();
+  oss << " request_num=" << _request_num.load(std::memory_order_relaxed);
+  oss << " queue_size=" << _queue->size();
+  oss << " queue_wait_us=" << _queue_wait_us.load(std::memory_order_relaxed);
+  oss << " rejected_conn_num=" << _rejected_conn_num.load();
+  oss << " rejected_req_num=" << _rejected_req_num.load();
+  oss << " cancelled_num=" << _cancelled_req_num.load();
+  const char *timeout_names[] = {"idle", "params", "stdin", "write"};
+  for (int i = 0; i < 4; ++i) {
+    long expired_num = 0;
+    for (auto &w : _wheels) expired_num += w->expired_num(FcgiTimeout(i));
+    oss << " " << timeout_names[i] << "_timeout_num=" << expired_num;
+  }
+  if (io_uring()) {
+    long enter_num = 0, submit_num = 0, complete_num = 0;
+    for (auto &u : _urings) {
+      enter_num += u->enter_num();
+      submit_num += u->submit_num();
+      complete_num += u->complete_num();
+    }
+    oss << " uring_enter_num=" << enter_num;
+    oss << " uring_submit_num=" << submit_num;
+    oss << " uring_complete_num=" << complete_num;
+  }
+  oss << " " << FcgiBufferPool::instance()->statistics();
+  oss << " " << FcgiObjectPool<FcgiRequest>::instance()->statistics("request");
+  oss << " "
+      << FcgiObjectPool<FcgiConnection>::instance()->statistics("connection");
+  oss << " " << FcgiRingPool::instance()->statistics();
   return oss.str();
 }
+
+std::string FcgiApp::metrics() const {
+  FcgiMetricsWriter writer;
+  collect_metrics(writer);
+  return writer.prometheus();
+}
+
+std::string FcgiApp::metrics_snapshot() const {
+  FcgiMetricsWriter writer;
+  collect_metrics(writer);
+  return writer.snapshot();
+}
+
+void FcgiApp::collect_metrics(FcgiMetricsWriter &writer) const {
+  FcgiMetrics::instance()->collect(writer);
+  writer.gauge("fcgi_connections", "Open connections.",
+               _connection_num.load(std::memory_order_relaxed));
+  writer.gauge("fcgi_requests_in_progress", "Requests not freed yet.",
+               _request_num.load(std::memory_order_relaxed));
+  writer.gauge("fcgi_queue_size", "Requests waiting in the queue.",
+               _queue->size());
+  writer.counter("fcgi_enqueued_requests_total", "Requests queued.",
+                 _enqueue_req_num.load());
+  writer.counter("fcgi_dequeued_requests_total",
+                 "Requests taken off the queue.", _dequeue_req_num.load());
+  writer.counter("fcgi_inline_requests_total",
+                 "Requests handled on the io threads.", _inline_req_num.load());
+  writer.counter("fcgi_rejected_connections_total",
+                 "Connections refused by admission control.",
+                 _rejected_conn_num.load());
+  writer.counter("fcgi_rejected_requests_total",
+                 "Requests answered FCGI_OVERLOADED.",
+                 _rejected_req_num.load());
+  writer.counter("fcgi_cancelled_requests_total",
+                 "Requests dropped from the queue, aborted by "
+                 "FCGI_ABORT_REQUEST or by a lost connection.",
+                 _cancelled_req_num.load());
+  const char *timeout_names[] = {"idle", "params", "stdin", "write"};
+  for (int i = 0; i < 4; ++i) {
+    long expired_num = 0;
+    for (auto &w : _wheels) expired_num += w->expired_num(FcgiTimeout(i));
+    writer.counter(std::string("fcgi_timeouts_total{kind=\"") +
+                       timeout_names[i] + "\"}",
+                   "Connections closed by a timeout.", expired_num);
+  }
+  auto buffer_pool = FcgiBufferPool::instance();
+  writer.gauge("fcgi_buffer_in_use_bytes", "Pooled buffer memory handed out.",
+               buffer_pool->in_use_bytes());
+  writer.gauge("fcgi_buffer_cached_bytes", "Pooled buffer memory kept free.",
+               buffer_pool->cached_bytes());
+}
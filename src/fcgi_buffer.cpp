@@ -0,0 +1,296 @@
+#include "fcgi_buffer.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <sstream>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const int FCGI_BUFFER_THREAD_CACHE_BYTES = 1024 * 1024;
+static const int FCGI_BUFFER_SHARED_CACHE_BYTES = 1024 * 1024 * 16;
+static const int FCGI_RING_CACHE_BYTES = 1024 * 1024 * 16;
+
+static int CacheLimit(int bytes, int len) { return std::max(2, bytes / len); }
+
+struct FcgiBufferPool::ThreadCache {
+  ThreadCache() : _free(FcgiBufferPool::class_num()) {}
+  ~ThreadCache() {
+    auto pool = FcgiBufferPool::instance();
+    for (int idx = 0; idx < int(_free.size()); ++idx) {
+      for (auto buf : _free[idx]) {
+        if (!pool->push_shared(idx, buf)) {
+          pool->_cached_num.fetch_sub(1, std::memory_order_relaxed);
+          pool->_cached_bytes.fetch_sub(class_length(idx),
+                                        std::memory_order_relaxed);
+          free(buf);
+        }
+      }
+    }
+  }
+
+  std::vector<std::vector<char *>> _free;
+};
+
+FcgiBufferPool::FcgiBufferPool()
+    : _classes(class_num()),
+      _in_use_num(0),
+      _in_use_bytes(0),
+      _cached_num(0),
+      _cached_bytes(0) {}
+
+FcgiBufferPool::~FcgiBufferPool() {
+  for (auto &c : _classes) {
+    for (auto buf : c._free) free(buf);
+  }
+}
+
+FcgiBufferPool *FcgiBufferPool::instance() {
+  static FcgiBufferPool s_pool;
+  return &s_pool;
+}
+
+FcgiBufferPool::ThreadCache &FcgiBufferPool::thread_cache() {
+  static thread_local ThreadCache t_cache;
+  return t_cache;
+}
+
+int FcgiBufferPool::class_num() {
+  return class_index(FCGI_BUFFER_MAX_LEN) + 1;
+}
+
+int FcgiBufferPool::class_index(int len) {
+  int idx = 0;
+  while ((FCGI_BUFFER_MIN_LEN << idx) < len) ++idx;
+  return idx;
+}
+
+int FcgiBufferPool::class_length(int idx) { return FCGI_BUFFER_MIN_LEN << idx; }
+
+char *FcgiBufferPool::acquire(int len, int *cap) {
+  const int idx = class_index(std::max(len, FCGI_BUFFER_MIN_LEN));
+  const int class_len = class_length(idx);
+  *cap = class_len;
+
+  _in_use_num.fetch_add(1, std::memory_order_relaxed);
+  _in_use_bytes.fetch_add(class_len, std::memory_order_relaxed);
+
+  auto &free_list = thread_cache()._free[idx];
+  char *buf = nullptr;
+  if (!free_list.empty()) {
+    buf = free_list.back();
+    free_list.pop_back();
+  } else {
+    buf = pop_shared(idx);
+  }
+
+  if (buf != nullptr) {
+    _cached_num.fetch_sub(1, std::memory_order_relaxed);
+    _cached_bytes.fetch_sub(class_len, std::memory_order_relaxed);
+    return buf;
+  }
+  return (char *)malloc(class_len);
+}
+
+void FcgiBufferPool::release(char *buf, int cap) {
+  if (buf == nullptr) return;
+
+  const int idx = class_index(cap);
+  _in_use_num.fetch_sub(1, std::memory_order_relaxed);
+  _in_use_bytes.fetch_sub(cap, std::memory_order_relaxed);
+  _cached_num.fetch_add(1, std::memory_order_relaxed);
+  _cached_bytes.fetch_add(cap, std::memory_order_relaxed);
+
+  auto &free_list = thread_cache()._free[idx];
+  if (int(free_list.size()) < CacheLimit(FCGI_BUFFER_THREAD_CACHE_BYTES, cap)) {
+    free_list.push_back(buf);
+  } else if (!push_shared(idx, buf)) {
+    _cached_num.fetch_sub(1, std::memory_order_relaxed);
+    _cached_bytes.fetch_sub(cap, std::memory_order_relaxed);
+    free(buf);
+  }
+}
+
+bool FcgiBufferPool::push_shared(int idx, char *buf) {
+  auto &c = _classes[idx];
+  std::lock_guard<std::mutex> guard(c._mutex);
+  if (CacheLimit(FCGI_BUFFER_SHARED_CACHE_BYTES, class_length(idx)) <=
+      int(c._free.size()))
+    return false;
+  c._free.push_back(buf);
+  return true;
+}
+
+char *FcgiBufferPool::pop_shared(int idx) {
+  auto &c = _classes[idx];
+  std::lock_guard<std::mutex> guard(c._mutex);
+  if (c._free.empty()) return nullptr;
+  char *buf = c._free.back();
+  c._free.pop_back();
+  return buf;
+}
+
+std::string FcgiBufferPool::statistics() const {
+  std::ostringstream oss;
+  oss << "buffer_in_use_num=" << _in_use_num.load(std::memory_order_relaxed);
+  oss << " buffer_in_use_bytes="
+      << _in_use_bytes.load(std::memory_order_relaxed);
+  oss << " buffer_cached_num=" << _cached_num.load(std::memory_order_relaxed);
+  oss << " buffer_cached_bytes="
+      << _cached_bytes.load(std::memory_order_relaxed);
+  return oss.str();
+}
+
+long FcgiBufferPool::in_use_bytes() const {
+  return _in_use_bytes.load(std::memory_order_relaxed);
+}
+
+long FcgiBufferPool::cached_bytes() const {
+  return _cached_bytes.load(std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////
+FcgiRingBuffer::FcgiRingBuffer(int len)
+    : _data(nullptr), _cap(capacity_for(len)), _mirrored(false) {
+#if defined(__linux__)
+  _mirrored = map_mirror();
+#endif
+  if (!_mirrored) _data = (char *)malloc(_cap);
+}
+
+FcgiRingBuffer::~FcgiRingBuffer() {
+#if defined(__linux__)
+  if (_mirrored) {
+    munmap(_data, _cap * 2);
+    return;
+  }
+#endif
+  free(_data);
+}
+
+char *FcgiRingBuffer::data() const { return _data; }
+
+int FcgiRingBuffer::capacity() const { return _cap; }
+
+bool FcgiRingBuffer::mirrored() const { return _mirrored; }
+
+int FcgiRingBuffer::capacity_for(int len) {
+#if defined(__linux__)
+  const int page = sysconf(_SC_PAGESIZE);
+  return (len + page - 1) / page * page;
+#else
+  return len;
+#endif
+}
+
+bool FcgiRingBuffer::map_mirror() {
+#if defined(__linux__)
+  const int fd = memfd_create("fcgi-ring", MFD_CLOEXEC);
+  if (fd < 0) return false;
+  if (ftruncate(fd, _cap) != 0) {
+    ::close(fd);
+    return false;
+  }
+
+  // reserve both halves first so that nothing else can land in between
+  void *base = mmap(nullptr, _cap * 2, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  bool ok = base != MAP_FAILED;
+  for (int i = 0; ok && i < 2; ++i) {
+    char *half = (char *)base + _cap * i;
+    ok = mmap(half, _cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+              0) == half;
+  }
+  ::close(fd);
+
+  if (!ok) {
+    if (base != MAP_FAILED) munmap(base, _cap * 2);
+    return false;
+  }
+  _data = (char *)base;
+  return true;
+#else
+  return false;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////
+FcgiRingPool::FcgiRingPool() : _classes(FcgiBufferPool::class_num()) {
+  for (auto &c : _classes) c._low = 0;
+}
+
+FcgiRingPool::~FcgiRingPool() {
+  for (auto &c : _classes) {
+    for (auto ring : c._free) delete ring;
+  }
+}
+
+FcgiRingPool *FcgiRingPool::instance() {
+  static FcgiRingPool s_pool;
+  return &s_pool;
+}
+
+// Rings are rounded up to whole pages, so no class is smaller than a page;
+// pages and class lengths being powers of two, a ring then has exactly the
+// length of its class.
+int FcgiRingPool::capacity(int len) {
+  static const int s_min_len =
+      std::max(FCGI_BUFFER_MIN_LEN, FcgiRingBuffer::capacity_for(1));
+  return FcgiBufferPool::class_length(
+      FcgiBufferPool::class_index(std::max(len, s_min_len)));
+}
+
+FcgiRingBuffer *FcgiRingPool::acquire(int len) {
+  const int cap = capacity(len);
+  auto &c = _classes[FcgiBufferPool::class_index(cap)];
+  {
+    std::lock_guard<std::mutex> guard(c._mutex);
+    if (!c._free.empty()) {
+      auto ring = c._free.back();
+      c._free.pop_back();
+      c._low = std::min<int>(c._low, c._free.size());
+      _hit_num.add();
+      return ring;
+    }
+  }
+  _miss_num.add();
+  return new FcgiRingBuffer(cap);
+}
+
+void FcgiRingPool::release(FcgiRingBuffer *ring) {
+  if (ring == nullptr) return;
+
+  const int idx = FcgiBufferPool::class_index(ring->capacity());
+  auto &c = _classes[idx];
+  {
+    std::lock_guard<std::mutex> guard(c._mutex);
+    if (int(c._free.size()) <
+        CacheLimit(FCGI_RING_CACHE_BYTES, ring->capacity())) {
+      c._free.push_back(ring);
+      return;
+    }
+  }
+  delete ring;
+}
+
+void FcgiRingPool::trim() {
+  for (auto &c : _classes) {
+    std::vector<FcgiRingBuffer *> idle;
+    {
+      std::lock_guard<std::mutex> guard(c._mutex);
+      idle.assign(c._free.begin(), c._free.begin() + c._low);
+      c._free.erase(c._free.begin(), c._free.begin() + c._low);
+      c._low = c._free.size();
+    }
+    for (auto ring : idle) delete ring;
+    _trim_num.add(idle.size());
+  }
+}
+
+std::string FcgiRingPool::statistics() const {
+  std::ostringstream oss;
+  oss << "ring_pool_hit_num=" << _hit_num.load();
+  oss << " ring_pool_miss_num=" << _miss_num.load();
+  oss << " ring_pool_trim_num=" << _trim_num.load();
+  return oss.str();
+}
@@ -0,0 +1,35 @@
+#include "fcgi_cancel.h"
+
+FcgiCancelToken::FcgiCancelToken() : _cancelled(false) {}
+
+bool FcgiCancelToken::cancelled() const {
+  return _cancelled.load(std::memory_order_acquire);
+}
+
+void FcgiCancelToken::on_cancel(FcgiCancelCallback callback) {
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (!cancelled()) {
+      _callbacks.push_back(std::move(callback));
+      return;
+    }
+  }
+  callback();
+}
+
+void FcgiCancelToken::cancel() {
+  std::vector<FcgiCancelCallback> callbacks;
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (cancelled()) return;
+    _cancelled.store(true, std::memory_order_release);
+    callbacks.swap(_callbacks);
+  }
+  for (auto &callback : callbacks) callback();
+}
+
+void FcgiCancelToken::reset() {
+  std::lock_guard<std::mutex> guard(_mutex);
+  _cancelled.store(false, std::memory_order_relaxed);
+  _callbacks.clear();
+}
@@ -1,9 +1,22 @@
 #include "fcgi_connection.h"
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#include <algorithm>
 #include <functional>
+#include <iterator>
 #include "fcgi_app.h"
+#include "fcgi_metrics.h"
 #include "fcgi_protocol.h"
 #include "fcgi_request.h"
+#include "fcgi_stdin.h"
+#include "fcgi_uring.h"
 using namespace std::placeholders;
 using namespace boost::asio;
 using namespace boost::asio::ip;
@@ -15,50 +28,196 @@ enum class ParseRecordError {
   Version,
   Type,
   NotComplete,
-  Multiplex,
   Protocol,
   EndParams,
   EndStdIn,
   AbortRequest,
 };
 
-FcgiConnection::FcgiConnection(tcp::socket *sock)
-    : _sock(sock),
-      _req(nullptr),
+static const int FCGI_CONNECTION_POOL_THREAD_NUM = 16;
+static const int FCGI_CONNECTION_POOL_SHARED_NUM = 256;
+
+template <>
+FcgiObjectPool<FcgiConnection> *FcgiObjectPool<FcgiConnection>::instance() {
+  static FcgiObjectPool s_pool(FCGI_CONNECTION_POOL_THREAD_NUM,
+                               FCGI_CONNECTION_POOL_SHARED_NUM);
+  return &s_pool;
+}
+
+// io_uring reports failures as -errno and the end of the stream as 0
+static error_code UringError(int res) {
+  if (res < 0) return error_code(-res, system_category());
+  if (res == 0) return error::eof;
+  return error_code();
+}
+
+FcgiConnection::FcgiConnection()
+    : _sock(nullptr),
+      _fd(-1),
+      _uring(nullptr),
       _has_pending_write(false),
-      _close_on_finish_write(false) {}
+      _close_on_finish_write(false),
+      _dispatched_num(0),
+      _created_ns(0),
+      _wheel(nullptr),
+      _timer_at(FcgiTimerWheel::NEVER),
+      _active_at(0),
+      _write_progress_at(0),
+      _read_deadline(FcgiTimerWheel::NEVER),
+      _read_timeout(FcgiTimeout::Params) {
+  memset(&_msg, 0, sizeof(_msg));
+}
 
 FcgiConnection::~FcgiConnection() {
+  if (0 <= _fd) recycle();
+}
+
+std::shared_ptr<FcgiConnection> FcgiConnection::create(FcgiSocket *sock) {
+  auto pool = FcgiObjectPool<FcgiConnection>::instance();
+  auto conn = pool->acquire();
+  conn->_sock = sock;
+  conn->_fd = sock->native_handle();
+  conn->_created_ns = FcgiMetrics::now_ns();
+  return std::shared_ptr<FcgiConnection>(
+      conn, [pool](FcgiConnection *c) { pool->release(c); });
+}
+
+std::shared_ptr<FcgiConnection> FcgiConnection::create(int fd,
+                                                       FcgiUring *uring) {
+  auto pool = FcgiObjectPool<FcgiConnection>::instance();
+  auto conn = pool->acquire();
+  conn->_fd = fd;
+  conn->_uring = uring;
+  conn->_created_ns = FcgiMetrics::now_ns();
+  return std::shared_ptr<FcgiConnection>(
+      conn, [pool](FcgiConnection *c) { pool->release(c); });
+}
+
+void FcgiConnection::recycle() {
   close();
   FcgiApp::instance()->decrease_connection_num();
+  FcgiMetrics::instance()->record_connection_lifetime(
+      (FcgiMetrics::now_ns() - _created_ns) / 1000000);
   delete _sock;
-  delete _req;
+  _sock = nullptr;
+  _fd = -1;
+  _uring = nullptr;
+
+  cancel_requests();
+  for (auto &kv : _reqs) FcgiApp::instance()->free_request(kv.second);
+  _reqs.clear();
+  for (auto &kv : _streams) kv.second->end(false);
+  _streams.clear();
+  _bodyless_ids.clear();
+  for (auto &callback : _writable_callbacks) callback(false);
+  _writable_callbacks.clear();
+
+  _reader.clear();
+  _writer.clear();
+  _has_pending_write = false;
+  _close_on_finish_write = false;
+  _dispatched_num = 0;
+  _wheel = nullptr;
+  _timer_at = FcgiTimerWheel::NEVER;
+  _read_deadline = FcgiTimerWheel::NEVER;
+  _params_begun.clear();
 }
 
 void FcgiConnection::post_async_read() {
+  if (_uring != nullptr) {
+    auto buf = _reader.buf();
+    auto self = shared_from_this();
+    _uring->recv(_fd, buf.data(), buf.size(), [self](int res, unsigned) {
+      self->read_handler(UringError(res), std::max(res, 0));
+    });
+    return;
+  }
+
   _sock->async_read_some(_reader.buf(), std::bind(&FcgiConnection::read_handler,
                                                   shared_from_this(), _1, _2));
 }
 
+void FcgiConnection::resume_read() {
+  std::shared_ptr<FcgiConnection> self;
+  std::lock_guard<std::mutex> guard(_mutex);
+  if (_paused_self != nullptr && !streams_backlogged()) {
+    self.swap(_paused_self);
+    update_read_deadline();
+    post_async_read();
+  }
+}
+
+bool FcgiConnection::streams_backlogged() const {
+  return std::any_of(std::begin(_streams), std::end(_streams),
+                     [](auto &kv) { return kv.second->backlogged(); });
+}
+
 void FcgiConnection::post_async_write() {
-  const_buffers_1 buf(_writer.buf());
-  if (buffer_size(buf) == 0) {
+  // a write starting from idle is making progress as of now
+  if (!_has_pending_write && _wheel != nullptr)
+    _write_progress_at = _wheel->now();
+
+  int fd = -1, len = 0;
+  off_t offset = 0;
+  if (_writer.file_pending(&fd, &offset, &len)) {
+    if (_uring != nullptr) {
+      auto self = shared_from_this();
+      _uring->poll(_fd, POLLOUT, [self](int res, unsigned) {
+        self->send_file_handler(res < 0 ? UringError(res) : error_code());
+      });
+    } else {
+      _sock->async_wait(socket_base::wait_write,
+                        std::bind(&FcgiConnection::send_file_handler,
+                                  shared_from_this(), _1));
+    }
+    _has_pending_write = true;
+    arm_timer();
+    return;
+  }
+
+  auto bufs = _writer.buf();
+  if (bufs.empty()) {
     _has_pending_write = false;
+  } else if (_uring != nullptr) {
+    // only one write is in flight, so _msg and _iovecs stay put until it
+    // completes
+    _iovecs.resize(bufs.size());
+    for (size_t i = 0; i < bufs.size(); ++i) {
+      _iovecs[i].iov_base = const_cast<void *>(bufs[i].data());
+      _iovecs[i].iov_len = bufs[i].size();
+    }
+    _msg.msg_iov = _iovecs.data();
+    _msg.msg_iovlen = _iovecs.size();
+    auto self = shared_from_this();
+    _uring->sendmsg(_fd, &_msg, [self](int res, unsigned) {
+      self->write_handler(res < 0 ? UringError(res) : error_code(),
+                          std::max(res, 0));
+    });
+    _has_pending_write = true;
   } else {
-    _sock->async_write_some(buf, std::bind(&FcgiConnection::write_handler,
-                                           shared_from_this(), _1, _2));
+    _sock->async_write_some(bufs, std::bind(&FcgiConnection::write_handler,
+                                            shared_from_this(), _1, _2));
     _has_pending_write = true;
   }
+  arm_timer();
 }
 
 void FcgiConnection::close() {
   error_code ec;
-  _sock->close(ec);
+  if (_sock != nullptr) {
+    _sock->close(ec);
+  } else if (0 <= _fd) {
+    ::close(_fd);
+  }
 }
 
 void FcgiConnection::shutdown() {
   error_code ec;
-  _sock->shutdown(tcp::socket::shutdown_both, ec);
+  if (_sock != nullptr) {
+    _sock->shutdown(socket_base::shutdown_both, ec);
+  } else {
+    ::shutdown(_fd, SHUT_RDWR);
+  }
 }
 
 bool FcgiConnection::stdout(int request_id, boost::asio::const_buffers_1 &buf) {
@@ -72,6 +231,34 @@ bool FcgiConnection::stdout(int request_id, boost::asio::const_buffers_1 &buf) {
   return ret;
 }
 
+bool FcgiConnection::stdout(int request_id, const const_buffer &buf,
+                            std::shared_ptr<const void> owner,
+                            FcgiWriteCallback callback) {
+  std::lock_guard<std::mutex> guard(_mutex);
+
+  bool ret = _writer.stdout(request_id, buf, std::move(owner),
+                            std::move(callback));
+  if (ret && !_has_pending_write) {
+    post_async_write();
+  }
+
+  return ret;
+}
+
+bool FcgiConnection::stdout_file(int request_id, int fd, off_t offset,
+                                 size_t len, std::shared_ptr<const void> owner,
+                                 FcgiWriteCallback callback) {
+  std::lock_guard<std::mutex> guard(_mutex);
+
+  bool ret = _writer.stdout_file(request_id, fd, offset, len, std::move(owner),
+                                 std::move(callback));
+  if (ret && !_has_pending_write) {
+    post_async_write();
+  }
+
+  return ret;
+}
+
 bool FcgiConnection::end_stdout(int request_id) {
   std::lock_guard<std::mutex> guard(_mutex);
 
@@ -83,10 +270,12 @@ bool FcgiConnection::end_stdout(int request_id) {
   return ret;
 }
 
-bool FcgiConnection::reply(int request_id, uint32_t code, bool close) {
+bool FcgiConnection::reply(int request_id, uint32_t code,
+                           uint8_t protocol_status, bool close) {
   std::lock_guard<std::mutex> guard(_mutex);
 
-  bool ret = _writer.reply(request_id, code);
+  bool ret = _writer.reply(request_id, code, protocol_status);
+  _cancel_tokens.erase(request_id);
   _close_on_finish_write = close;
   if (ret && !_has_pending_write) {
     post_async_write();
@@ -95,28 +284,71 @@ bool FcgiConnection::reply(int request_id, uint32_t code, bool close) {
   return ret;
 }
 
+// The id may have been reused by a newer request by now, whose token differs.
+void FcgiConnection::release_request(
+    int request_id, const std::shared_ptr<FcgiCancelToken> &token) {
+  std::lock_guard<std::mutex> guard(_mutex);
+  auto it = _cancel_tokens.find(request_id);
+  if (it != _cancel_tokens.end() && it->second == token)
+    _cancel_tokens.erase(it);
+  // idle from now on
+  if (--_dispatched_num == 0 && _wheel != nullptr) {
+    _active_at = _wheel->now();
+    arm_timer();
+  }
+}
+
+bool FcgiConnection::writable() {
+  std::lock_guard<std::mutex> guard(_mutex);
+  return _writer.pending_length() <= FcgiApp::instance()->write_high_watermark();
+}
+
+void FcgiConnection::on_writable(FcgiWriteCallback callback) {
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (FcgiApp::instance()->write_low_watermark() < _writer.pending_length()) {
+      _writable_callbacks.push_back(std::move(callback));
+      FcgiMetrics::instance()->add_write_stall();
+      return;
+    }
+  }
+  callback(true);
+}
+
 void FcgiConnection::read_handler(const error_code &rc,
                                   size_t bytes_transferred) {
   if (!rc) {
+    auto metrics = FcgiMetrics::instance();
+    metrics->add_bytes_in(bytes_transferred);
     _reader.transferred(bytes_transferred);
 
+    // counted locally and added once per read
+    long record_nums[FCGI_MAXTYPE + 1] = {0};
+    _reader.scan();
     while (_reader.can_read()) {
+      const int type = _reader.type();
       switch (parse_record()) {
         case ParseRecordError::Ok:
+          ++record_nums[type];
+          _reader.next_record();
+          break;
         case ParseRecordError::EndParams:
+          ++record_nums[type];
+          end_params(_reader.request_id());
           _reader.next_record();
           break;
         case ParseRecordError::Head:
         case ParseRecordError::Version:
         case ParseRecordError::Type:
-        case ParseRecordError::Multiplex:
         case ParseRecordError::Protocol:
         case ParseRecordError::AbortRequest:
+          metrics->add_records(record_nums);
           return;
         case ParseRecordError::NotComplete:
           break;
         case ParseRecordError::EndStdIn:
-          deal_request();
+          ++record_nums[type];
+          deal_request(_reader.request_id());
           _reader.next_record();
           break;
         default:
@@ -125,11 +357,18 @@ void FcgiConnection::read_handler(const error_code &rc,
       }
     }
 
+    metrics->add_records(record_nums);
     _reader.clear_complete_record();
 
-    if (_reader.buf_full()) {
-    } else {
-      post_async_read();
+    if (!_reader.buf_full() || _reader.grow()) {
+      std::lock_guard<std::mutex> guard(_mutex);
+      if (_wheel != nullptr) _active_at = _wheel->now();
+      update_read_deadline();
+      if (streams_backlogged()) {
+        _paused_self = shared_from_this();
+      } else {
+        post_async_read();
+      }
     }
   } else {
   }
@@ -138,15 +377,67 @@ void FcgiConnection::read_handler(const error_code &rc,
 void FcgiConnection::write_handler(const error_code &rc,
                                    size_t bytes_transferred) {
   if (!rc) {
-    std::lock_guard<std::mutex> guard(_mutex);
-    _writer.transferred(bytes_transferred);
-    if (_close_on_finish_write && _writer.buf_empty()) {
-      shutdown();
-    } else {
-      post_async_write();
+    std::vector<FcgiWriteCallback> finished;
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      _writer.transferred(bytes_transferred, finished);
+      FcgiMetrics::instance()->add_bytes_out(bytes_transferred);
+      if (0 < bytes_transferred && _wheel != nullptr)
+        _write_progress_at = _active_at = _wheel->now();
+      if (!_writable_callbacks.empty() &&
+          _writer.pending_length() <=
+              FcgiApp::instance()->write_low_watermark()) {
+        std::move(std::begin(_writable_callbacks),
+                  std::end(_writable_callbacks), std::back_inserter(finished));
+        _writable_callbacks.clear();
+      }
+      if (_close_on_finish_write && _writer.buf_empty()) {
+        shutdown();
+      } else {
+        post_async_write();
+      }
     }
+    for (auto &callback : finished) callback(true);
   } else {
+    // fails the pending read too, so that the connection goes and cancels
+    // its requests
+    shutdown();
+  }
+}
+
+// Sends the file segment at the front of the writer with sendfile() once
+// the socket is writable, then carries on like any other write.
+void FcgiConnection::send_file_handler(const error_code &rc) {
+  if (rc) {
+    write_handler(rc, 0);
+    return;
+  }
+
+  int fd = -1, len = 0;
+  off_t offset = 0;
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    _writer.file_pending(&fd, &offset, &len);
+  }
+
+  error_code ec;
+  size_t bytes_transferred = 0;
+#if defined(__linux__)
+  // sockets accepted through io_uring are non-blocking already
+  if (_sock != nullptr) _sock->native_non_blocking(true, ec);
+  const ssize_t n = ::sendfile(_fd, fd, &offset, len);
+  if (0 < n) {
+    bytes_transferred = n;
+  } else if (n == 0) {
+    // the file is shorter than promised, the stream cannot be completed
+    ec = error::eof;
+  } else if (errno != EAGAIN && errno != EINTR) {
+    ec = error_code(errno, system_category());
   }
+#else
+  ec = error::operation_not_supported;
+#endif
+  write_handler(ec, bytes_transferred);
 }
 
 ParseRecordError FcgiConnection::parse_record() {
@@ -172,39 +463,81 @@ ParseRecordError FcgiConnection::parse_record() {
   return ParseRecordError::Ok;
 }
 
+FcgiRequest *FcgiConnection::find_request(int request_id) const {
+  auto it = _reqs.find(request_id);
+  return it == _reqs.end() ? nullptr : it->second;
+}
+
 ParseRecordError FcgiConnection::parse_begin_request_record() {
-  if (_req != nullptr) return ParseRecordError::Multiplex;
+  const int request_id = _reader.request_id();
+  if (request_id == FCGI_NULL_REQUEST_ID) return ParseRecordError::Protocol;
+  if (find_request(request_id) != nullptr) return ParseRecordError::Protocol;
+  _bodyless_ids.erase(request_id);
+
+  // turned away before anything is spent on it; the records still to come
+  // for it are ignored like those of any inactive request
+  if (!FcgiApp::instance()->admit_request()) {
+    reply(request_id, 0, FCGI_OVERLOADED,
+          !(_reader.flags() & FCGI_KEEP_CONN));
+    return ParseRecordError::Ok;
+  }
 
-  _req = new FcgiRequest;
-  _req->set_request_id(_reader.request_id());
-  _req->set_role(_reader.role());
-  _req->set_flags(_reader.flags());
+  _params_begun[request_id] = _wheel != nullptr ? _wheel->now() : 0;
+  auto req = FcgiRequest::create();
+  req->set_request_id(request_id);
+  req->set_role(_reader.role());
+  req->set_flags(_reader.flags());
+  _reqs[request_id] = req;
 
   return ParseRecordError::Ok;
 }
 
+// Records addressed to a request id that is not active are ignored, as
+// required by the FastCGI spec.
 ParseRecordError FcgiConnection::parse_params_record() {
-  if (_req == nullptr) return ParseRecordError::Protocol;
-  if (_req->request_id() != _reader.request_id())
-    return ParseRecordError::Multiplex;
+  auto req = find_request(_reader.request_id());
+  if (req == nullptr) return ParseRecordError::Ok;
 
-  ParamsVector vec;
-  _reader.params(vec);
-  if (vec.empty()) return ParseRecordError::EndParams;
+  _params_vec.clear();
+  _reader.params(_params_vec);
+  if (_params_vec.empty()) return ParseRecordError::EndParams;
 
-  _req->add_params(vec);
+  req->add_params(_params_vec);
   return ParseRecordError::Ok;
 }
 
 ParseRecordError FcgiConnection::parse_stdin_record() {
-  if (_req == nullptr) return ParseRecordError::Protocol;
-  if (_req->request_id() != _reader.request_id())
-    return ParseRecordError::Multiplex;
-
+  const int request_id = _reader.request_id();
   const const_buffer buf(_reader.content());
-  if (buffer_size(buf) == 0) return ParseRecordError::EndStdIn;
 
-  _req->add_stdin_data(buf);
+  auto req = find_request(request_id);
+  if (req != nullptr) {
+    if (buffer_size(buf) == 0) return ParseRecordError::EndStdIn;
+    req->add_stdin_data(buf);
+    return ParseRecordError::Ok;
+  }
+
+  auto it = _streams.find(request_id);
+  if (it == _streams.end()) {
+    // a request dispatched as body-less must not get a body after all
+    auto bodyless = _bodyless_ids.find(request_id);
+    if (bodyless != _bodyless_ids.end()) {
+      if (buffer_size(buf) != 0) return ParseRecordError::Protocol;
+      _bodyless_ids.erase(bodyless);
+    }
+    return ParseRecordError::Ok;
+  }
+
+  if (buffer_size(buf) == 0) {
+    auto stream = it->second;
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      _streams.erase(it);
+    }
+    stream->end(true);
+  } else {
+    it->second->push(buf);
+  }
   return ParseRecordError::Ok;
 }
 
@@ -213,19 +546,203 @@ ParseRecordError FcgiConnection::parse_data_record() {
   return ParseRecordError::Protocol;
 }
 
+// A request still being received is answered here.  A dispatched one is
+// cancelled, and its handler is left to answer it, or FcgiApp if it has not
+// left the queue yet.
 ParseRecordError FcgiConnection::parse_abort_request_record() {
-  assert(false);
-  return ParseRecordError::AbortRequest;
+  const int request_id = _reader.request_id();
+  auto req = find_request(request_id);
+  if (req != nullptr) {
+    const bool close = !(req->flags() & FCGI_KEEP_CONN);
+    _reqs.erase(request_id);
+    _params_begun.erase(request_id);
+    FcgiApp::instance()->free_request(req);
+    reply(request_id, 0, FCGI_REQUEST_COMPLETE, close);
+    return ParseRecordError::Ok;
+  }
+
+  std::shared_ptr<FcgiCancelToken> token;
+  std::shared_ptr<FcgiStdinStream> stream;
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    auto it = _cancel_tokens.find(request_id);
+    if (it != _cancel_tokens.end()) token = it->second;
+    auto stream_it = _streams.find(request_id);
+    if (stream_it != _streams.end()) {
+      stream = stream_it->second;
+      _streams.erase(stream_it);
+    }
+  }
+  if (stream != nullptr) stream->end(false);
+  if (token != nullptr) token->cancel();
+  return ParseRecordError::Ok;
 }
 
 ParseRecordError FcgiConnection::parse_get_values_record() {
-  assert(false);
-  return ParseRecordError::Protocol;
+  if (_reader.request_id() != FCGI_NULL_REQUEST_ID)
+    return ParseRecordError::Protocol;
+
+  _params_vec.clear();
+  _reader.params(_params_vec);
+
+  ParamsMap values;
+  std::for_each(std::begin(_params_vec), std::end(_params_vec),
+                [&values](auto &p) {
+                  std::string name(p._name, p._name_len), value;
+                  if (FcgiApp::instance()->get_value(name, value))
+                    values[name] = value;
+                });
+
+  std::lock_guard<std::mutex> guard(_mutex);
+  if (_writer.get_values_result(values) && !_has_pending_write) {
+    post_async_write();
+  }
+  return ParseRecordError::Ok;
 }
 
-int FcgiConnection::deal_request() {
-  _req->set_connection(weak_from_this());
-  FcgiApp::instance()->push_request(_req);
-  _req = nullptr;
+int FcgiConnection::deal_request(int request_id) {
+  auto it = _reqs.find(request_id);
+  auto req = it->second;
+  _reqs.erase(it);
+
+  req->set_connection(weak_from_this());
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    _cancel_tokens[request_id] = req->cancel_token();
+    ++_dispatched_num;
+  }
+  FcgiApp::instance()->dispatch_request(req);
   return 0;
 }
+
+void FcgiConnection::start_timer(FcgiTimerWheel *wheel) {
+  std::lock_guard<std::mutex> guard(_mutex);
+  _wheel = wheel;
+  _active_at = _wheel->now();
+  arm_timer();
+}
+
+void FcgiConnection::check_timeouts(long when, long now) {
+  FcgiTimeout timeout = FcgiTimeout::Idle;
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    // an earlier deadline has been scheduled since
+    if (when != _timer_at || _wheel == nullptr) return;
+
+    const long deadline = next_deadline(&timeout);
+    if (now < deadline) {
+      _timer_at = deadline;
+      if (deadline != FcgiTimerWheel::NEVER)
+        _wheel->schedule(weak_from_this(), deadline);
+      return;
+    }
+    _timer_at = FcgiTimerWheel::NEVER;
+    _wheel->expired(timeout);
+  }
+  if (timeout == FcgiTimeout::Write) {
+    // the peer takes nothing, lingering on close would only block
+    struct linger l = {1, 0};
+    setsockopt(_fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+  }
+  // fails the pending read, and the connection goes once nothing holds it
+  shutdown();
+}
+
+// Idle only counts while nothing is received, answered or sent.  Must be
+// called under _mutex, like the two below.
+long FcgiConnection::next_deadline(FcgiTimeout *timeout) const {
+  const FcgiTimeouts &t = FcgiApp::instance()->timeouts();
+  long deadline = FcgiTimerWheel::NEVER;
+  if (_has_pending_write && 0 < t.write_timeout.count()) {
+    deadline = _write_progress_at + t.write_timeout.count();
+    *timeout = FcgiTimeout::Write;
+  }
+  if (_read_deadline != FcgiTimerWheel::NEVER) {
+    if (_read_deadline < deadline) {
+      deadline = _read_deadline;
+      *timeout = _read_timeout;
+    }
+  } else if (!_has_pending_write && _dispatched_num == 0 &&
+             0 < t.idle_timeout.count()) {
+    deadline = _active_at + t.idle_timeout.count();
+    *timeout = FcgiTimeout::Idle;
+  }
+  return deadline;
+}
+
+// Deadlines moving later are left to check_timeouts() to find.
+void FcgiConnection::arm_timer() {
+  if (_wheel == nullptr) return;
+  FcgiTimeout timeout;
+  const long deadline = next_deadline(&timeout);
+  if (deadline < _timer_at) {
+    _timer_at = deadline;
+    _wheel->schedule(weak_from_this(), deadline);
+  }
+}
+
+// Params are due a fixed time after BEGIN_REQUEST; a body only has to keep
+// coming, unless reading is paused on behalf of the handler.
+void FcgiConnection::update_read_deadline() {
+  if (_wheel == nullptr) return;
+  const FcgiTimeouts &t = FcgiApp::instance()->timeouts();
+  _read_deadline = FcgiTimerWheel::NEVER;
+  if (!_params_begun.empty() && 0 < t.params_timeout.count()) {
+    long begun = FcgiTimerWheel::NEVER;
+    for (auto &kv : _params_begun) begun = std::min(begun, kv.second);
+    _read_deadline = begun + t.params_timeout.count();
+    _read_timeout = FcgiTimeout::Params;
+  } else if ((!_reqs.empty() || !_streams.empty()) &&
+             !streams_backlogged() && 0 < t.stdin_timeout.count()) {
+    _read_deadline = _wheel->now() + t.stdin_timeout.count();
+    _read_timeout = FcgiTimeout::Stdin;
+  }
+  arm_timer();
+}
+
+// The connection is lost for every request it has dispatched.
+void FcgiConnection::cancel_requests() {
+  std::unordered_map<int, std::shared_ptr<FcgiCancelToken>> tokens;
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    tokens.swap(_cancel_tokens);
+  }
+  for (auto &kv : tokens) kv.second->cancel();
+}
+
+// GET, HEAD and DELETE requests without CONTENT_LENGTH, or with a zero one,
+// have no body to wait for and are dispatched right away.  Any other request
+// may still carry one, say a POST whose body the web server streams without
+// a length, and waits for its STDIN.
+static bool Bodyless(const FcgiRequest *req) {
+  const auto method = req->known(CgiVar::RequestMethod);
+  if (!method || (*method != "GET" && *method != "HEAD" && *method != "DELETE"))
+    return false;
+  return !req->known(CgiVar::ContentLength) || req->content_length() == 0;
+}
+
+int FcgiConnection::end_params(int request_id) {
+  _params_begun.erase(request_id);
+  auto req = find_request(request_id);
+  if (req == nullptr) return -1;
+
+  if (Bodyless(req)) {
+    _bodyless_ids.insert(request_id);
+    return deal_request(request_id);
+  }
+  if (FcgiApp::instance()->stdin_streaming()) return stream_request(request_id);
+  return 0;
+}
+
+int FcgiConnection::stream_request(int request_id) {
+  auto req = find_request(request_id);
+  if (req == nullptr) return -1;
+
+  auto stream = std::make_shared<FcgiStdinStream>(weak_from_this());
+  req->set_stdin_stream(stream);
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    _streams[request_id] = stream;
+  }
+  return deal_request(request_id);
+}
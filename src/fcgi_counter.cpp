@@ -0,0 +1,25 @@
+#include "fcgi_counter.h"
+
+static std::atomic_int s_next_shard(0);
+
+FcgiCounter::FcgiCounter() { reset(); }
+
+int FcgiCounter::shard_index() {
+  static thread_local int t_shard =
+      s_next_shard.fetch_add(1, std::memory_order_relaxed) % SHARD_NUM;
+  return t_shard;
+}
+
+void FcgiCounter::add(long n) {
+  _shards[shard_index()]._value.fetch_add(n, std::memory_order_relaxed);
+}
+
+long FcgiCounter::load() const {
+  long sum = 0;
+  for (auto &s : _shards) sum += s._value.load(std::memory_order_relaxed);
+  return sum;
+}
+
+void FcgiCounter::reset() {
+  for (auto &s : _shards) s._value.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,244 @@
+#include "fcgi_metrics.h"
+#include <stdint.h>
+#include <algorithm>
+#include <sstream>
+#include "fcgi_protocol.h"
+
+FcgiHistogram::FcgiHistogram() : _shards(new Shard[SHARD_NUM]) { reset(); }
+
+int FcgiHistogram::bucket_index(long value) {
+  const int sub_num = 1 << SUB_BITS;
+  if (value < sub_num) return std::max(value, 0L);
+  const int msb = 63 - __builtin_clzl(value);
+  if (MAX_BITS <= msb) return BUCKET_NUM - 1;
+  const int shift = msb - SUB_BITS;
+  return ((shift + 1) << SUB_BITS) + ((value >> shift) & (sub_num - 1));
+}
+
+long FcgiHistogram::bucket_upper(int idx) {
+  const int sub_num = 1 << SUB_BITS;
+  if (idx < sub_num) return idx;
+  const int shift = (idx >> SUB_BITS) - 1;
+  const long lower = long(sub_num + (idx & (sub_num - 1))) << shift;
+  return lower + (1L << shift) - 1;
+}
+
+void FcgiHistogram::record(long value) {
+  Shard &s = _shards[FcgiCounter::shard_index() % SHARD_NUM];
+  s._buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+  s._sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+FcgiHistogram::Snapshot FcgiHistogram::snapshot() const {
+  Snapshot snap{0, 0, std::vector<long>(BUCKET_NUM)};
+  for (int i = 0; i < SHARD_NUM; ++i) {
+    const Shard &s = _shards[i];
+    snap._sum += s._sum.load(std::memory_order_relaxed);
+    for (int b = 0; b < BUCKET_NUM; ++b)
+      snap._buckets[b] += s._buckets[b].load(std::memory_order_relaxed);
+  }
+  for (long n : snap._buckets) snap._count += n;
+  return snap;
+}
+
+void FcgiHistogram::reset() {
+  for (int i = 0; i < SHARD_NUM; ++i) {
+    Shard &s = _shards[i];
+    s._sum.store(0, std::memory_order_relaxed);
+    for (auto &b : s._buckets) b.store(0, std::memory_order_relaxed);
+  }
+}
+
+long FcgiHistogram::Snapshot::percentile(double p) const {
+  if (_count == 0) return 0;
+  const long rank = std::max(1L, long(_count * p / 100 + 0.5));
+  long seen = 0;
+  for (size_t i = 0; i < _buckets.size(); ++i) {
+    seen += _buckets[i];
+    if (rank <= seen) return FcgiHistogram::bucket_upper(i);
+  }
+  return FcgiHistogram::bucket_upper(_buckets.size() - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////
+void FcgiMetricsWriter::counter(const std::string &name, const char *help,
+                                long value) {
+  _samples.push_back(Sample{Counter, name, help, value, 0, {}});
+}
+
+void FcgiMetricsWriter::gauge(const std::string &name, const char *help,
+                              long value) {
+  _samples.push_back(Sample{Gauge, name, help, value, 0, {}});
+}
+
+void FcgiMetricsWriter::histogram(const std::string &name, const char *help,
+                                  const FcgiHistogram &h, long unit_ns) {
+  _samples.push_back(Sample{Histogram, name, help, 0, unit_ns, h.snapshot()});
+}
+
+static std::string FamilyName(const std::string &name) {
+  return name.substr(0, name.find('{'));
+}
+
+// Buckets are exported at every power of two, finer ones are left to the
+// binary snapshot.
+std::string FcgiMetricsWriter::prometheus() const {
+  static const char *kind_names[] = {"counter", "gauge", "histogram"};
+  std::ostringstream oss;
+  std::string family;
+  for (auto &s : _samples) {
+    if (FamilyName(s._name) != family) {
+      family = FamilyName(s._name);
+      oss << "# HELP " << family << " " << s._help << "\n";
+      oss << "# TYPE " << family << " " << kind_names[s._kind] << "\n";
+    }
+    if (s._kind != Histogram) {
+      oss << s._name << " " << s._value << "\n";
+      continue;
+    }
+
+    const double unit = s._unit_ns / 1e9;
+    long cumulative = 0;
+    int idx = 0;
+    for (int bits = FcgiHistogram::SUB_BITS; bits <= FcgiHistogram::MAX_BITS;
+         ++bits) {
+      const long le = 1L << bits;
+      for (; FcgiHistogram::bucket_upper(idx) < le; ++idx)
+        cumulative += s._histogram._buckets[idx];
+      oss << s._name << "_bucket{le=\"" << le * unit << "\"} " << cumulative
+          << "\n";
+    }
+    oss << s._name << "_bucket{le=\"+Inf\"} " << s._histogram._count << "\n";
+    oss << s._name << "_sum " << s._histogram._sum * unit << "\n";
+    oss << s._name << "_count " << s._histogram._count << "\n";
+  }
+  return oss.str();
+}
+
+static void AppendVarint(std::string &out, uint64_t v) {
+  while (0x80 <= v) {
+    out += char((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  out += char(v);
+}
+
+std::string FcgiMetricsWriter::snapshot() const {
+  std::string out("FCGM\x01", 5);
+  AppendVarint(out, _samples.size());
+  for (auto &s : _samples) {
+    out += char(s._kind);
+    AppendVarint(out, s._name.size());
+    out += s._name;
+    if (s._kind != Histogram) {
+      AppendVarint(out, (uint64_t(s._value) << 1) ^ uint64_t(s._value >> 63));
+      continue;
+    }
+
+    const auto &h = s._histogram;
+    AppendVarint(out, s._unit_ns);
+    AppendVarint(out, h._count);
+    AppendVarint(out, h._sum);
+    AppendVarint(out, h._buckets.size() - std::count(h._buckets.begin(),
+                                                     h._buckets.end(), 0));
+    int last = 0;
+    for (int i = 0; i < int(h._buckets.size()); ++i) {
+      if (h._buckets[i] == 0) continue;
+      AppendVarint(out, i - last);
+      AppendVarint(out, h._buckets[i]);
+      last = i;
+    }
+  }
+  return out;
+}
+
+////////////////////////////////////////////////////////////////////////////
+static const int FCGI_HANDLER_SAMPLE_PERIOD = 16;
+
+FcgiMetrics::FcgiMetrics()
+    : _handler_sample_period(FCGI_HANDLER_SAMPLE_PERIOD) {}
+
+FcgiMetrics *FcgiMetrics::instance() {
+  static FcgiMetrics s_metrics;
+  return &s_metrics;
+}
+
+long FcgiMetrics::now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void FcgiMetrics::set_handler_sample_period(int period) {
+  _handler_sample_period = std::max(period, 1);
+}
+
+int FcgiMetrics::handler_sample_period() const {
+  return _handler_sample_period;
+}
+
+bool FcgiMetrics::sample_handler() {
+  static thread_local int t_countdown = 0;
+  if (0 < t_countdown--) return false;
+  t_countdown = _handler_sample_period - 1;
+  return true;
+}
+
+void FcgiMetrics::record_queue_wait(long ns) { _queue_wait.record(ns); }
+
+void FcgiMetrics::record_handler_time(long ns) { _handler_time.record(ns); }
+
+void FcgiMetrics::record_connection_lifetime(long ms) {
+  _connection_lifetime.record(ms);
+}
+
+void FcgiMetrics::add_bytes_in(long n) { _bytes_in.add(n); }
+
+void FcgiMetrics::add_bytes_out(long n) { _bytes_out.add(n); }
+
+void FcgiMetrics::add_records(const long *nums) {
+  for (int i = 0; i < RECORD_TYPE_NUM; ++i) {
+    if (nums[i] != 0) _record_nums[i].add(nums[i]);
+  }
+}
+
+void FcgiMetrics::add_write_stall() { _write_stall_num.add(); }
+
+void FcgiMetrics::collect(FcgiMetricsWriter &w) const {
+  static const char *type_names[RECORD_TYPE_NUM] = {
+      nullptr,      "begin_request", "abort_request",     "end_request",
+      "params",     "stdin",         "stdout",            "stderr",
+      "data",       "get_values",    "get_values_result", "unknown_type"};
+
+  w.histogram("fcgi_queue_wait_seconds",
+              "Time requests spent in the request queue.", _queue_wait, 1);
+  w.histogram("fcgi_handler_seconds",
+              "Time from the start of handling a request to its release, "
+              "sampled.",
+              _handler_time, 1);
+  w.histogram("fcgi_connection_lifetime_seconds",
+              "Time from accept to release of connections.",
+              _connection_lifetime, 1000 * 1000);
+  w.counter("fcgi_received_bytes_total", "Bytes read from connections.",
+            _bytes_in.load());
+  w.counter("fcgi_sent_bytes_total", "Bytes written to connections.",
+            _bytes_out.load());
+  for (int i = 1; i <= FCGI_MAXTYPE; ++i) {
+    w.counter(std::string("fcgi_records_total{type=\"") + type_names[i] + "\"}",
+              "Records parsed, by type.", _record_nums[i].load());
+  }
+  w.counter("fcgi_write_stalls_total",
+            "Times a producer waited for its connection's unsent output to "
+            "fall to the low write watermark.",
+            _write_stall_num.load());
+}
+
+void FcgiMetrics::reset() {
+  _queue_wait.reset();
+  _handler_time.reset();
+  _connection_lifetime.reset();
+  _bytes_in.reset();
+  _bytes_out.reset();
+  for (auto &c : _record_nums) c.reset();
+  _write_stall_num.reset();
+}
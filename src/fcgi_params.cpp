@@ -0,0 +1,114 @@
+#include "fcgi_params.h"
+#include <string.h>
+#include <algorithm>
+
+static const int FCGI_PARAMS_ARENA_LEN = 1024 * 2;
+static const int FCGI_PARAMS_ENTRY_NUM = 48;
+
+static long ParseContentLength(std::string_view s) {
+  if (s.empty() || 18 < s.size()) return -1;
+  long n = 0;
+  for (char c : s) {
+    if (c < '0' || '9' < c) return -1;
+    n = n * 10 + (c - '0');
+  }
+  return n;
+}
+
+FcgiParamTable::FcgiParamTable() {
+  _arena.reserve(FCGI_PARAMS_ARENA_LEN);
+  _entries.reserve(FCGI_PARAMS_ENTRY_NUM);
+  clear();
+}
+
+uint32_t FcgiParamTable::hash(std::string_view s) {
+  uint32_t h = 2166136261u;
+  for (unsigned char c : s) h = (h ^ c) * 16777619u;
+  return h;
+}
+
+void FcgiParamTable::add(const ParamsVector &vec) {
+  // grown geometrically, or a request sending its params a record at a time
+  // would copy the arena on every record
+  size_t len = _arena.size();
+  for (auto &p : vec) len += p._name_len + p._value_len;
+  if (_arena.capacity() < len)
+    _arena.reserve(std::max(len, 2 * _arena.capacity()));
+  const size_t num = _entries.size() + vec.size();
+  if (_entries.capacity() < num)
+    _entries.reserve(std::max(num, 2 * _entries.capacity()));
+
+  for (auto &p : vec) {
+    add(std::string_view(p._name, p._name_len),
+        std::string_view(p._value, p._value_len));
+  }
+}
+
+void FcgiParamTable::add(std::string_view name, std::string_view value) {
+  Entry e;
+  e._hash = hash(name);
+  e._name_off = _arena.size();
+  e._name_len = name.size();
+  e._value_len = value.size();
+
+  _arena.insert(_arena.end(), name.begin(), name.end());
+  _arena.insert(_arena.end(), value.begin(), value.end());
+  _entries.push_back(e);
+
+  const int var = cgi_var_index(name);
+  if (0 <= var) {
+    _known[var] = _entries.size() - 1;
+    if (var == int(CgiVar::ContentLength))
+      _content_length = ParseContentLength(value);
+  }
+}
+
+void FcgiParamTable::clear() {
+  _arena.clear();
+  _entries.clear();
+  std::fill(std::begin(_known), std::end(_known), -1);
+  _content_length = -1;
+}
+
+std::optional<std::string_view> FcgiParamTable::known(CgiVar var) const {
+  const int idx = _known[int(var)];
+  if (idx < 0) return std::nullopt;
+  return at(idx).second;
+}
+
+long FcgiParamTable::content_length() const { return _content_length; }
+
+std::optional<std::string_view> FcgiParamTable::find(
+    std::string_view name) const {
+  const int var = cgi_var_index(name);
+  if (0 <= var) return known(CgiVar(var));
+
+  const uint32_t h = hash(name);
+  for (int i = int(_entries.size()) - 1; 0 <= i; --i) {
+    const Entry &e = _entries[i];
+    if (e._hash != h || e._name_len != name.size()) continue;
+    const char *n = _arena.data() + e._name_off;
+    if (memcmp(n, name.data(), name.size()) != 0) continue;
+    return std::string_view(n + e._name_len, e._value_len);
+  }
+  return std::nullopt;
+}
+
+int FcgiParamTable::size() const { return _entries.size(); }
+
+bool FcgiParamTable::empty() const { return _entries.empty(); }
+
+FcgiParamTable::Param FcgiParamTable::at(int idx) const {
+  const Entry &e = _entries[idx];
+  const char *n = _arena.data() + e._name_off;
+  return Param(std::string_view(n, e._name_len),
+               std::string_view(n + e._name_len, e._value_len));
+}
+
+FcgiParamTable::const_iterator FcgiParamTable::begin() const {
+  return const_iterator(this, 0);
+}
+
+FcgiParamTable::const_iterator FcgiParamTable::end() const {
+  return const_iterator(this, size());
+}
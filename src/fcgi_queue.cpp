@@ -0,0 +1,106 @@
+#include "fcgi_queue.h"
+#include <algorithm>
+#include <thread>
+
+static size_t RoundUpPow2(int n) {
+  size_t v = 2;
+  while (v < size_t(n)) v <<= 1;
+  return v;
+}
+
+FcgiRequestQueue::FcgiRequestQueue(int capacity)
+    : _cells(RoundUpPow2(capacity)),
+      _mask(_cells.size() - 1),
+      _spin_count(1000),
+      _enqueue_pos(0),
+      _dequeue_pos(0),
+      _sleeper_num(0) {
+  for (size_t i = 0; i < _cells.size(); ++i) {
+    _cells[i]._seq.store(i, std::memory_order_relaxed);
+    _cells[i]._req = nullptr;
+  }
+}
+
+FcgiRequestQueue::~FcgiRequestQueue() {}
+
+int FcgiRequestQueue::capacity() const { return _cells.size(); }
+
+int FcgiRequestQueue::size() const {
+  const size_t dequeue_pos = _dequeue_pos.load(std::memory_order_relaxed);
+  const size_t enqueue_pos = _enqueue_pos.load(std::memory_order_relaxed);
+  return std::max(intptr_t(enqueue_pos - dequeue_pos), intptr_t(0));
+}
+
+int FcgiRequestQueue::spin_count() const { return _spin_count; }
+
+void FcgiRequestQueue::set_spin_count(int n) { _spin_count = n; }
+
+bool FcgiRequestQueue::try_push(FcgiRequest *req) {
+  Cell *cell = nullptr;
+  size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+  for (;;) {
+    cell = &_cells[pos & _mask];
+    size_t seq = cell->_seq.load(std::memory_order_acquire);
+    intptr_t diff = intptr_t(seq) - intptr_t(pos);
+    if (diff == 0) {
+      if (_enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = _enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+
+  cell->_req = req;
+  cell->_seq.store(pos + 1, std::memory_order_release);
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (0 < _sleeper_num.load(std::memory_order_relaxed)) wake_up();
+  return true;
+}
+
+FcgiRequest *FcgiRequestQueue::try_pop() {
+  Cell *cell = nullptr;
+  size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+  for (;;) {
+    cell = &_cells[pos & _mask];
+    size_t seq = cell->_seq.load(std::memory_order_acquire);
+    intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+    if (diff == 0) {
+      if (_dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return nullptr;
+    } else {
+      pos = _dequeue_pos.load(std::memory_order_relaxed);
+    }
+  }
+
+  FcgiRequest *req = cell->_req;
+  cell->_seq.store(pos + _mask + 1, std::memory_order_release);
+  return req;
+}
+
+FcgiRequest *FcgiRequestQueue::pop_blocking() {
+  for (int i = 0; i < _spin_count; ++i) {
+    FcgiRequest *req = try_pop();
+    if (req != nullptr) return req;
+    if ((i & 0x3f) == 0x3f) std::this_thread::yield();
+  }
+
+  std::unique_lock<std::mutex> guard(_mutex);
+  _sleeper_num.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  FcgiRequest *req = nullptr;
+  while ((req = try_pop()) == nullptr) _cond.wait(guard);
+  _sleeper_num.fetch_sub(1, std::memory_order_relaxed);
+  return req;
+}
+
+void FcgiRequestQueue::wake_up() {
+  { std::lock_guard<std::mutex> guard(_mutex); }
+  _cond.notify_one();
+}
@@ -1,54 +1,72 @@
 #include "fcgi_record.h"
 #include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include "fcgi_buffer.h"
 #include "fcgi_protocol.h"
 using namespace boost::asio;
 
-static const int FCGI_RECORD_MAX_LEN = 1024 * 128 * 8;
+static const int FCGI_RECORD_MAX_LEN = FCGI_BUFFER_MAX_LEN;
 static const int FCGI_CONTENT_MAX_LEN = 65528;
+static const int FCGI_WRITE_MAX_BUFS = 64;
+static const int FCGI_WRITE_CHUNK_MAX_LEN = 1024 * 64;
+static const int FCGI_WRITE_SPLIT_MIN_LEN = 1024;
 static int AlignInt8(unsigned n) { return (n + 7) & (UINT_MAX - 7); }
 
-FcgiRecordReader::FcgiRecordReader()
-    : _buf((char *)malloc(FCGI_RECORD_MAX_LEN)), _len(0), _idx(0) {}
-
-FcgiRecordReader::~FcgiRecordReader() { free(_buf); }
+int FcgiRecordHead::complete_length() const {
+  return FCGI_HEADER_LEN + _content_len + _padding_len;
+}
 
-bool FcgiRecordReader::can_read() const {
-  return has_valid_head() && is_complete();
+FcgiRecordReader::FcgiRecordReader()
+    : _ring(nullptr), _buf(nullptr), _cap(0), _len(0), _idx(0), _cur(0) {}
+
+FcgiRecordReader::~FcgiRecordReader() { release_ring(); }
+
+int FcgiRecordReader::decode_heads(const char *buf, int len,
+                                   std::vector<FcgiRecordHead> &heads) {
+  const unsigned char *next = (const unsigned char *)buf;
+  const int num = heads.size();
+  while (FCGI_HEADER_LEN <= len) {
+    FcgiRecordHead h;
+    h._version = next[0];
+    h._type = next[1];
+    h._request_id = (next[2] << 8) | next[3];
+    h._content_len = (next[4] << 8) | next[5];
+    h._padding_len = next[6];
+
+    const int total = h.complete_length();
+    if (len < total) break;
+    heads.push_back(h);
+    next += total;
+    len -= total;
+  }
+  return heads.size() - num;
 }
 
-int FcgiRecordReader::complete_length() const {
-  return FCGI_HEADER_LEN + content_length() + padding_length();
+int FcgiRecordReader::scan() {
+  _heads.clear();
+  _cur = 0;
+  return decode_heads(_buf + _idx, _len, _heads);
 }
 
-bool FcgiRecordReader::is_complete() const { return complete_length() <= _len; }
+bool FcgiRecordReader::can_read() const { return _cur < int(_heads.size()); }
 
-bool FcgiRecordReader::has_valid_head() const {
-  return FCGI_HEADER_LEN <= _len;
+int FcgiRecordReader::complete_length() const {
+  return _heads[_cur].complete_length();
 }
 
-int FcgiRecordReader::version() const {
-  const FCGI_Header *head = (FCGI_Header *)(_buf + _idx);
-  return head->version;
-}
+int FcgiRecordReader::version() const { return _heads[_cur]._version; }
 
-int FcgiRecordReader::type() const {
-  const FCGI_Header *head = (FCGI_Header *)(_buf + _idx);
-  return head->type;
-}
+int FcgiRecordReader::type() const { return _heads[_cur]._type; }
 
-int FcgiRecordReader::request_id() const {
-  const FCGI_Header *head = (FCGI_Header *)(_buf + _idx);
-  return (int(head->requestIdB1) << 8) + head->requestIdB0;
-}
+int FcgiRecordReader::request_id() const { return _heads[_cur]._request_id; }
 
 int FcgiRecordReader::content_length() const {
-  const FCGI_Header *head = (FCGI_Header *)(_buf + _idx);
-  return (int(head->contentLengthB1) << 8) + head->contentLengthB0;
+  return _heads[_cur]._content_len;
 }
 
 int FcgiRecordReader::padding_length() const {
-  const FCGI_Header *head = (FCGI_Header *)(_buf + _idx);
-  return head->paddingLength;
+  return _heads[_cur]._padding_len;
 }
 
 int FcgiRecordReader::role() const {
@@ -65,131 +83,218 @@ int FcgiRecordReader::flags() const {
   return b.flags;
 }
 
-void FcgiRecordReader::params(ParamsVector &vec) const {
-  int content_len = content_length();
-  unsigned char *next = (unsigned char *)(_buf + _idx + FCGI_HEADER_LEN);
-
-  while (0 < content_len) {
-    int param_len = 0;
-    FcgiParam param;
-
-    if ((*next >> 7) == 0) {
-      param._name_len = *next;
-      next += 1;
-      ++param_len;
-    } else {
-      param._name_len = int(*next & 0x7f) << 24;
-      next += 1;
-      param._name_len += int(*next) << 16;
-      next += 1;
-      param._name_len += int(*next) << 8;
-      next += 1;
-      param._name_len += int(*next);
-      next += 1;
-
-      param_len += 4;
-    }
-    param_len += param._name_len;
+static bool DecodeLength(const unsigned char *&next, const unsigned char *end,
+                         int *len) {
+  if (end <= next) return false;
+  if ((*next >> 7) == 0) {
+    *len = *next++;
+    return true;
+  }
+  if (end - next < 4) return false;
+  *len = (int(next[0] & 0x7f) << 24) + (int(next[1]) << 16) +
+         (int(next[2]) << 8) + int(next[3]);
+  next += 4;
+  return true;
+}
 
-    if ((*next >> 7) == 0) {
-      param._value_len = *next;
-      next += 1;
-      ++param_len;
-    } else {
-      param._value_len = int(*next & 0x7f) << 24;
-      next += 1;
-      param._value_len += int(*next) << 16;
-      next += 1;
-      param._value_len += int(*next) << 8;
-      next += 1;
-      param._value_len += int(*next);
-      next += 1;
-
-      param_len += 4;
+// Decoding stops at the first pair that would run past the content.
+void FcgiRecordReader::decode_params(const char *content, int len,
+                                     ParamsVector &vec) {
+  const unsigned char *next = (const unsigned char *)content;
+  const unsigned char *end = next + len;
+  vec.reserve(vec.size() + len / 16 + 1);
+
+  while (next < end) {
+    int name_len = 0, value_len = 0;
+    if (2 <= end - next && ((next[0] | next[1]) >> 7) == 0) {
+      // both lengths fit in one byte, which is by far the common case
+      name_len = next[0];
+      value_len = next[1];
+      next += 2;
+    } else if (!DecodeLength(next, end, &name_len) ||
+               !DecodeLength(next, end, &value_len)) {
+      return;
     }
-    param_len += param._value_len;
-
-    param._name = (char *)next;
-    next += param._name_len;
-    param._value = (char *)next;
-    next += param._value_len;
-    vec.push_back(param);
+    if (end - next < long(name_len) + value_len) return;
 
-    content_len -= param_len;
+    char *name = (char *)next;
+    vec.emplace_back(name, name + name_len, name_len, value_len);
+    next += name_len + value_len;
   }
 }
 
+void FcgiRecordReader::params(ParamsVector &vec) const {
+  decode_params(_buf + _idx + FCGI_HEADER_LEN, content_length(), vec);
+}
+
 const_buffers_1 FcgiRecordReader::content() const {
   return const_buffers_1(_buf + _idx + FCGI_HEADER_LEN, content_length());
 }
 
-mutable_buffers_1 FcgiRecordReader::buf() const {
-  return mutable_buffers_1(_buf + _idx + _len,
-                           std::max(0, FCGI_RECORD_MAX_LEN - _idx - _len));
+mutable_buffers_1 FcgiRecordReader::buf() {
+  if (_ring == nullptr) acquire_ring();
+  return mutable_buffers_1(_buf + _idx + _len, space());
+}
+
+// Free bytes after the buffered ones.  Through the mirror they always run on
+// past the end of the ring up to the first unconsumed byte.
+int FcgiRecordReader::space() const {
+  return _ring->mirrored() ? _cap - _len : _cap - _idx - _len;
 }
 
 bool FcgiRecordReader::buf_full() const {
-  return FCGI_RECORD_MAX_LEN <= _idx + _len;
+  return _ring != nullptr && space() == 0;
+}
+
+bool FcgiRecordReader::grow() {
+  if (_ring == nullptr || FCGI_RECORD_MAX_LEN <= _cap) return false;
+
+  // straight to the size the partial record needs, if its head is in
+  int cap = _cap * 2;
+  if (FCGI_HEADER_LEN <= _len) {
+    const unsigned char *head = (const unsigned char *)_buf + _idx;
+    const int len = FCGI_HEADER_LEN + ((head[4] << 8) | head[5]) + head[6];
+    while (cap < len) cap *= 2;
+  }
+  auto ring =
+      FcgiRingPool::instance()->acquire(std::min(cap, FCGI_RECORD_MAX_LEN));
+  if (0 != _len) memcpy(ring->data(), _buf + _idx, _len);
+  release_ring();
+  _ring = ring;
+  _buf = _ring->data();
+  _cap = _ring->capacity();
+  _idx = 0;
+  return true;
+}
+
+void FcgiRecordReader::acquire_ring() {
+  _ring = FcgiRingPool::instance()->acquire(FCGI_BUFFER_MIN_LEN);
+  _buf = _ring->data();
+  _cap = _ring->capacity();
+  _idx = 0;
+}
+
+void FcgiRecordReader::release_ring() {
+  if (_ring == nullptr) return;
+  FcgiRingPool::instance()->release(_ring);
+  _ring = nullptr;
+  _buf = nullptr;
+  _cap = 0;
 }
 
 void FcgiRecordReader::next_record() {
   const int total = complete_length();
   _idx += total;
   _len -= total;
+  if (_ring->mirrored() && _cap <= _idx) _idx -= _cap;
+  ++_cur;
 }
 
+// Only a ring without a mirror has to move a partial record to the front.
+// An empty ring grown for a large record is traded for a smallest one.
 void FcgiRecordReader::clear_complete_record() {
-  if (_idx != 0) {
-    if (0 != _len) memmove(_buf, _buf + _idx, _len);
+  if (_len == 0) {
+    _idx = 0;
+    if (_ring != nullptr &&
+        _cap != FcgiRingPool::capacity(FCGI_BUFFER_MIN_LEN)) {
+      release_ring();
+      acquire_ring();
+    }
+  } else if (!_ring->mirrored() && _idx != 0) {
+    memmove(_buf, _buf + _idx, _len);
     _idx = 0;
   }
 }
 
 void FcgiRecordReader::transferred(int len) { _len += len; }
 
+void FcgiRecordReader::clear() {
+  release_ring();
+  _len = 0;
+  _idx = 0;
+  _heads.clear();
+  _cur = 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////
-FcgiRecordWriter::FcgiRecordWriter()
-    : _buf((char *)malloc(FCGI_RECORD_MAX_LEN)), _len(0) {}
+FcgiRecordWriter::FcgiRecordWriter() : _next(nullptr), _pending_len(0) {}
+
+FcgiRecordWriter::~FcgiRecordWriter() { clear(); }
 
-FcgiRecordWriter::~FcgiRecordWriter() { free(_buf); }
+void FcgiRecordWriter::clear() {
+  for (auto &seg : _segments) {
+    if (seg._callback) seg._callback(false);
+  }
+  _segments.clear();
+
+  for (auto &chunk : _chunks)
+    FcgiBufferPool::instance()->release(chunk._buf, chunk._cap);
+  _chunks.clear();
+  _next = nullptr;
+  _pending_len = 0;
+}
 
 void FcgiRecordWriter::set_version(int v) {
-  FCGI_Header *head = (FCGI_Header *)(_buf + _len);
+  FCGI_Header *head = (FCGI_Header *)_next;
   head->version = v;
 }
 
 void FcgiRecordWriter::set_type(int t) {
-  FCGI_Header *head = (FCGI_Header *)(_buf + _len);
+  FCGI_Header *head = (FCGI_Header *)_next;
   head->type = t;
 }
 
 void FcgiRecordWriter::set_request_id(int id) {
-  FCGI_Header *head = (FCGI_Header *)(_buf + _len);
+  FCGI_Header *head = (FCGI_Header *)_next;
   head->requestIdB1 = (id & 0x0000ff00) >> 8;
   head->requestIdB0 = id & 0x000000ff;
 }
 
 void FcgiRecordWriter::set_content_length(int contentLen) {
-  FCGI_Header *head = (FCGI_Header *)(_buf + _len);
+  FCGI_Header *head = (FCGI_Header *)_next;
   head->contentLengthB1 = (contentLen & 0x0000ff00) >> 8;
   head->contentLengthB0 = contentLen & 0x000000ff;
 }
 
 void FcgiRecordWriter::set_content(const_buffers_1 &content) {
-  char *body = _buf + _len + FCGI_HEADER_LEN;
+  char *body = _next + FCGI_HEADER_LEN;
   unsigned contentLen = buffer_size(content);
   memcpy(body, buffer_cast<const char *>(content), contentLen);
   set_content_length(contentLen);
   set_padding(AlignInt8(contentLen) - contentLen);
+  // pooled chunks still hold whatever another connection wrote in them
+  memset(body + contentLen, 0, padding_length());
+}
+
+void FcgiRecordWriter::set_name_value(const std::string &name,
+                                      const std::string &value) {
+  unsigned char *next = (unsigned char *)(_next + FCGI_HEADER_LEN +
+                                          content_length());
+  for (auto len : {name.size(), value.size()}) {
+    if (len < 0x80) {
+      *next++ = len;
+    } else {
+      *next++ = ((len >> 24) & 0x7f) | 0x80;
+      *next++ = (len >> 16) & 0xff;
+      *next++ = (len >> 8) & 0xff;
+      *next++ = len & 0xff;
+    }
+  }
+  memcpy(next, name.data(), name.size());
+  next += name.size();
+  memcpy(next, value.data(), value.size());
+  next += value.size();
+
+  set_content_length((char *)next - (_next + FCGI_HEADER_LEN));
 }
 
 void FcgiRecordWriter::set_padding(int paddingLen) {
-  FCGI_Header *head = (FCGI_Header *)(_buf + _len);
+  FCGI_Header *head = (FCGI_Header *)_next;
   head->paddingLength = paddingLen;
 }
 
 void FcgiRecordWriter::set_app_status(uint32_t code) {
-  FCGI_EndRequestRecord *record = (FCGI_EndRequestRecord *)(_buf + _len);
+  FCGI_EndRequestRecord *record = (FCGI_EndRequestRecord *)_next;
   FCGI_EndRequestBody &b = record->body;
   b.appStatusB3 = (code & 0xff000000) >> 24;
   b.appStatusB2 = (code & 0x00ff0000) >> 16;
@@ -198,21 +303,63 @@ void FcgiRecordWriter::set_app_status(uint32_t code) {
 }
 
 void FcgiRecordWriter::set_protocol_status(int code) {
-  FCGI_EndRequestRecord *record = (FCGI_EndRequestRecord *)(_buf + _len);
+  FCGI_EndRequestRecord *record = (FCGI_EndRequestRecord *)_next;
   FCGI_EndRequestBody &b = record->body;
   b.protocolStatus = code;
 }
 
-const_buffers_1 FcgiRecordWriter::buf() const {
-  return const_buffers_1(_buf, _len);
+// Stops short of the first file segment, see file_pending().
+std::vector<const_buffer> FcgiRecordWriter::buf() const {
+  std::vector<const_buffer> bufs;
+  const int num = std::min<int>(_segments.size(), FCGI_WRITE_MAX_BUFS);
+  bufs.reserve(num);
+  for (int i = 0; i < num && _segments[i]._fd < 0; ++i)
+    bufs.emplace_back(_segments[i]._data, _segments[i]._len);
+  return bufs;
 }
 
-bool FcgiRecordWriter::buf_empty() const { return _len == 0; }
+bool FcgiRecordWriter::file_pending(int *fd, off_t *offset, int *len) const {
+  if (_segments.empty() || _segments.front()._fd < 0) return false;
+  *fd = _segments.front()._fd;
+  *offset = _segments.front()._offset;
+  *len = _segments.front()._len;
+  return true;
+}
+
+bool FcgiRecordWriter::buf_empty() const { return _segments.empty(); }
+
+long FcgiRecordWriter::pending_length() const { return _pending_len; }
 
-void FcgiRecordWriter::next_record() { _len += complete_length(); }
+void FcgiRecordWriter::next_record() { append_internal(complete_length()); }
 
-bool FcgiRecordWriter::can_write(int len) const {
-  return len <= FCGI_RECORD_MAX_LEN - _len;
+void FcgiRecordWriter::append_internal(int len) {
+  Chunk &chunk = _chunks.back();
+  if (chunk._len == 0 || _segments.empty() || !_segments.back()._internal ||
+      _segments.back()._data + _segments.back()._len != _next)
+    _segments.push_back(Segment{_next, 0, nullptr, nullptr, true, -1, 0});
+  _segments.back()._len += len;
+  chunk._len += len;
+  _next += len;
+  _pending_len += len;
+}
+
+int FcgiRecordWriter::room() const {
+  return _chunks.empty() ? 0 : _chunks.back()._cap - _chunks.back()._len;
+}
+
+// Bytes already framed are never moved: once the last chunk runs out of
+// room another one, up to twice as large, is chained behind it.
+bool FcgiRecordWriter::can_write(int len) {
+  if (len <= room()) return true;
+  if (FCGI_BUFFER_MAX_LEN < len) return false;
+
+  int cap = _chunks.empty() ? FCGI_BUFFER_MIN_LEN
+                            : std::min(_chunks.back()._cap * 2,
+                                       FCGI_WRITE_CHUNK_MAX_LEN);
+  char *buf = FcgiBufferPool::instance()->acquire(std::max(cap, len), &cap);
+  _chunks.push_back(Chunk{buf, cap, 0, 0});
+  _next = buf;
+  return true;
 }
 
 int FcgiRecordWriter::complete_length() const {
@@ -220,36 +367,58 @@ int FcgiRecordWriter::complete_length() const {
 }
 
 int FcgiRecordWriter::content_length() const {
-  const FCGI_Header *head = (FCGI_Header *)(_buf + _len);
+  const FCGI_Header *head = (FCGI_Header *)_next;
   return (int(head->contentLengthB1) << 8) + head->contentLengthB0;
 }
 
 int FcgiRecordWriter::padding_length() const {
-  const FCGI_Header *head = (FCGI_Header *)(_buf + _len);
+  const FCGI_Header *head = (FCGI_Header *)_next;
   return head->paddingLength;
 }
 
-void FcgiRecordWriter::transferred(int len) {
-  _len -= len;
-  memmove(_buf, _buf + len, _len);
-}
+void FcgiRecordWriter::transferred(int len,
+                                   std::vector<FcgiWriteCallback> &finished) {
+  _pending_len -= len;
+  while (!_segments.empty()) {
+    Segment &seg = _segments.front();
+    const int n = std::min(len, seg._len);
+    if (seg._fd < 0) {
+      seg._data += n;
+    } else {
+      seg._offset += n;
+    }
+    seg._len -= n;
+    len -= n;
+    if (seg._internal) sent_internal(n);
 
-bool FcgiRecordWriter::stdout(int request_id,
-                              boost::asio::const_buffers_1 &buf) {
-  int buf_len = buffer_size(buf);
-  int record_num = buf_len / FCGI_CONTENT_MAX_LEN;
-  int bytes_required = (FCGI_HEADER_LEN + FCGI_CONTENT_MAX_LEN) * record_num;
-  int last_record_len = buf_len % FCGI_CONTENT_MAX_LEN;
-  if (last_record_len != 0) {
-    ++record_num;
-    bytes_required += FCGI_HEADER_LEN + AlignInt8(last_record_len);
+    if (seg._len != 0) break;
+    if (seg._callback) finished.push_back(std::move(seg._callback));
+    _segments.pop_front();
   }
+}
 
-  if (!can_write(bytes_required)) return false;
+// An internal segment never spans chunks and chunks are sent in order, so
+// the bytes always belong to the first chunk.
+void FcgiRecordWriter::sent_internal(int len) {
+  Chunk &chunk = _chunks.front();
+  chunk._sent += len;
+  if (chunk._sent != chunk._len) return;
+
+  FcgiBufferPool::instance()->release(chunk._buf, chunk._cap);
+  _chunks.pop_front();
+  if (_chunks.empty()) _next = nullptr;
+}
 
+bool FcgiRecordWriter::stdout(int request_id,
+                              boost::asio::const_buffers_1 &buf) {
   const char *b = buffer_cast<const char *>(buf);
+  int buf_len = buffer_size(buf);
   while (0 < buf_len) {
     int record_len = std::min(FCGI_CONTENT_MAX_LEN, buf_len);
+    // top the last chunk up rather than leave a large tail of it unused
+    const int fit = (room() - FCGI_HEADER_LEN) & ~7;
+    if (FCGI_WRITE_SPLIT_MIN_LEN <= fit) record_len = std::min(record_len, fit);
+    if (!can_write(FCGI_HEADER_LEN + AlignInt8(record_len))) return false;
 
     set_version(FCGI_VERSION_1);
     set_type(FCGI_STDOUT);
@@ -266,6 +435,82 @@ bool FcgiRecordWriter::stdout(int request_id,
   return true;
 }
 
+bool FcgiRecordWriter::stdout(int request_id, const const_buffer &buf,
+                              std::shared_ptr<const void> owner,
+                              FcgiWriteCallback callback) {
+  Segment body{buffer_cast<const char *>(buf), 0, std::move(owner), nullptr,
+               false, -1, 0};
+  return frame_stdout(request_id, body, buffer_size(buf), std::move(callback));
+}
+
+bool FcgiRecordWriter::stdout_file(int request_id, int fd, off_t offset,
+                                   size_t len,
+                                   std::shared_ptr<const void> owner,
+                                   FcgiWriteCallback callback) {
+#if defined(__linux__)
+  Segment body{nullptr, 0, std::move(owner), nullptr, false, fd, offset};
+  return frame_stdout(request_id, body, len, std::move(callback));
+#else
+  // no sendfile() to rely on, the bytes take the zero-copy path instead
+  auto data = std::make_shared<std::string>(len, '\0');
+  const ssize_t n = pread(fd, &(*data)[0], len, offset);
+  if (n != ssize_t(len)) return false;
+  return stdout(request_id, const_buffer(data->data(), len), data,
+                std::move(callback));
+#endif
+}
+
+// Frames len bytes described by body: headers and padding are written here
+// and the content is referenced, one segment per record.
+bool FcgiRecordWriter::frame_stdout(int request_id, const Segment &body,
+                                    size_t len, FcgiWriteCallback callback) {
+  const size_t record_num =
+      (len + FCGI_CONTENT_MAX_LEN - 1) / FCGI_CONTENT_MAX_LEN;
+  if (FCGI_BUFFER_MAX_LEN / (FCGI_HEADER_LEN + 7) < record_num) return false;
+  if (!can_write(record_num * (FCGI_HEADER_LEN + 7))) return false;
+
+  Segment seg = body;
+  Segment *last = nullptr;
+  while (0 < len) {
+    int record_len = std::min<size_t>(FCGI_CONTENT_MAX_LEN, len);
+    int padding_len = AlignInt8(record_len) - record_len;
+
+    set_version(FCGI_VERSION_1);
+    set_type(FCGI_STDOUT);
+    set_request_id(request_id);
+    set_content_length(record_len);
+    set_padding(padding_len);
+    append_internal(FCGI_HEADER_LEN);
+
+    seg._len = record_len;
+    _segments.push_back(seg);
+    _pending_len += record_len;
+    last = &_segments.back();
+
+    if (padding_len != 0) {
+      memset(_next, 0, padding_len);
+      append_internal(padding_len);
+    }
+
+    if (seg._fd < 0) {
+      seg._data += record_len;
+    } else {
+      seg._offset += record_len;
+    }
+    len -= record_len;
+  }
+
+  if (last == nullptr || 0 <= last->_fd) {
+    // a callback is never left on a file segment, which may only be sent
+    // after a wait for the socket
+    _segments.push_back(
+        Segment{nullptr, 0, body._owner, nullptr, false, -1, 0});
+    last = &_segments.back();
+  }
+  last->_callback = std::move(callback);
+  return true;
+}
+
 bool FcgiRecordWriter::end_stdout(int request_id) {
   int bytes_required = FCGI_HEADER_LEN;
 
@@ -282,6 +527,11 @@ bool FcgiRecordWriter::end_stdout(int request_id) {
 }
 
 bool FcgiRecordWriter::reply(int request_id, uint32_t code) {
+  return reply(request_id, code, FCGI_REQUEST_COMPLETE);
+}
+
+bool FcgiRecordWriter::reply(int request_id, uint32_t code,
+                             uint8_t protocol_status) {
   int bytes_required = FCGI_HEADER_LEN + 8;
 
   if (!can_write(bytes_required)) return false;
@@ -292,7 +542,30 @@ bool FcgiRecordWriter::reply(int request_id, uint32_t code) {
   set_content_length(8);
   set_padding(0);
   set_app_status(code);
-  set_protocol_status(FCGI_REQUEST_COMPLETE);
+  set_protocol_status(protocol_status);
+
+  next_record();
+  return true;
+}
+
+bool FcgiRecordWriter::get_values_result(const ParamsMap &values) {
+  int content_len = 0;
+  for (auto &v : values) {
+    content_len += (v.first.size() < 0x80 ? 1 : 4) + v.first.size();
+    content_len += (v.second.size() < 0x80 ? 1 : 4) + v.second.size();
+  }
+  if (0xffff < content_len) return false;
+
+  int bytes_required = FCGI_HEADER_LEN + AlignInt8(content_len);
+  if (!can_write(bytes_required)) return false;
+
+  set_version(FCGI_VERSION_1);
+  set_type(FCGI_GET_VALUES_RESULT);
+  set_request_id(FCGI_NULL_REQUEST_ID);
+  set_content_length(0);
+  for (auto &v : values) set_name_value(v.first, v.second);
+  set_padding(AlignInt8(content_len) - content_len);
+  memset(_next + FCGI_HEADER_LEN + content_len, 0, padding_length());
 
   next_record();
   return true;
@@ -1,11 +1,66 @@
 #include "fcgi_request.h"
+#include <algorithm>
+#include <future>
+#include "fcgi_app.h"
 #include "fcgi_connection.h"
 #include "fcgi_protocol.h"
 using namespace boost::asio;
 
-FcgiRequest::FcgiRequest() : _request_id(0), _role(0), _flags(0) {}
+static const long FCGI_STDIN_RESERVE_MAX_LEN = 1024 * 1024;
+static const int FCGI_REQUEST_POOL_THREAD_NUM = 256;
+static const int FCGI_REQUEST_POOL_SHARED_NUM = 1024 * 4;
 
-FcgiRequest::~FcgiRequest() {}
+template <>
+FcgiObjectPool<FcgiRequest> *FcgiObjectPool<FcgiRequest>::instance() {
+  static FcgiObjectPool s_pool(FCGI_REQUEST_POOL_THREAD_NUM,
+                               FCGI_REQUEST_POOL_SHARED_NUM);
+  return &s_pool;
+}
+
+FcgiRequest::FcgiRequest()
+    : _request_id(0),
+      _role(0),
+      _flags(0),
+      _stdin_read(false),
+      _cancel_token(std::make_shared<FcgiCancelToken>()),
+      _queued_ns(0),
+      _started_ns(0) {}
+
+FcgiRequest::~FcgiRequest() {
+  if (_stdin_stream != nullptr) _stdin_stream->discard();
+}
+
+FcgiRequest *FcgiRequest::create() {
+  return FcgiObjectPool<FcgiRequest>::instance()->acquire();
+}
+
+// The params and a body buffer of up to FCGI_STDIN_RESERVE_MAX_LEN keep their
+// capacity for the next request.
+void FcgiRequest::recycle() {
+  if (_stdin_stream != nullptr) _stdin_stream->discard();
+  _stdin_stream = nullptr;
+  auto conn = _conn.lock();
+  if (conn != nullptr) conn->release_request(_request_id, _cancel_token);
+  _conn.reset();
+  _request_id = 0;
+  _role = 0;
+  _flags = 0;
+  _params.clear();
+  if (FCGI_STDIN_RESERVE_MAX_LEN < long(_stdin.capacity())) {
+    std::string().swap(_stdin);
+  } else {
+    _stdin.clear();
+  }
+  _stdin_read = false;
+  _queued_ns = 0;
+  _started_ns = 0;
+  // a connection still holding the token must not see it reset
+  if (_cancel_token.use_count() == 1) {
+    _cancel_token->reset();
+  } else {
+    _cancel_token = std::make_shared<FcgiCancelToken>();
+  }
+}
 
 int FcgiRequest::request_id() const { return _request_id; }
 
@@ -19,19 +74,31 @@ int FcgiRequest::flags() const { return _flags; }
 
 void FcgiRequest::set_flags(int flags) { _flags = flags; }
 
-const ParamsMap &FcgiRequest::params() const { return _params; }
+ParamsMap FcgiRequest::params() const {
+  ParamsMap map;
+  for (auto p : _params) map[std::string(p.first)] = std::string(p.second);
+  return map;
+}
+
+const FcgiParamTable &FcgiRequest::param_table() const { return _params; }
 
-void FcgiRequest::add_params(const ParamsVector &vec) {
-  std::for_each(std::begin(vec), std::end(vec), [this](auto &p) {
-    _params[std::string(p._name, p._name_len)] =
-        std::string(p._value, p._value_len);
-  });
+void FcgiRequest::add_params(const ParamsVector &vec) { _params.add(vec); }
+
+std::optional<std::string_view> FcgiRequest::param(
+    std::string_view name) const {
+  return _params.find(name);
 }
 
+std::optional<std::string_view> FcgiRequest::known(CgiVar var) const {
+  return _params.known(var);
+}
+
+long FcgiRequest::content_length() const { return _params.content_length(); }
+
 bool FcgiRequest::get_param(const char *name, std::string &value) const {
-  auto it = _params.find(name);
-  if (it == _params.end()) return false;
-  value = it->second;
+  auto v = _params.find(name);
+  if (!v) return false;
+  value.assign(v->data(), v->size());
   return true;
 }
 
@@ -42,13 +109,65 @@ bool FcgiRequest::get_param(const std::string &name, std::string &value) const {
 const std::string &FcgiRequest::stdin() const { return _stdin; }
 
 void FcgiRequest::add_stdin_data(const const_buffer &buf) {
-  _stdin += std::string(buffer_cast<const char *>(buf), buffer_size(buf));
+  if (_stdin.empty()) {
+    _stdin.reserve(std::min(std::max(content_length(), 0L),
+                            FCGI_STDIN_RESERVE_MAX_LEN));
+  }
+  _stdin.append(buffer_cast<const char *>(buf), buffer_size(buf));
+}
+
+bool FcgiRequest::stdin_streaming() const { return _stdin_stream != nullptr; }
+
+bool FcgiRequest::read_stdin(std::string &chunk) {
+  if (_stdin_stream != nullptr)
+    return _stdin_stream->read(chunk, !FcgiApp::in_io_thread());
+
+  if (_stdin_read || _stdin.empty()) return false;
+  _stdin_read = true;
+  chunk = _stdin;
+  return true;
+}
+
+void FcgiRequest::on_stdin(FcgiStdinHandler handler) {
+  if (_stdin_stream != nullptr) {
+    _stdin_stream->set_handler(std::move(handler));
+    return;
+  }
+
+  if (!_stdin.empty()) handler(buffer(_stdin), false);
+  handler(const_buffer(), true);
+}
+
+bool FcgiRequest::stdin_complete() const {
+  return _stdin_stream == nullptr || _stdin_stream->complete();
+}
+
+void FcgiRequest::set_stdin_stream(std::shared_ptr<FcgiStdinStream> stream) {
+  _stdin_stream = std::move(stream);
 }
 
 void FcgiRequest::set_connection(std::weak_ptr<FcgiConnection> ptr) {
   _conn = ptr;
 }
 
+bool FcgiRequest::cancelled() const { return _cancel_token->cancelled(); }
+
+void FcgiRequest::on_cancel(FcgiCancelCallback callback) {
+  _cancel_token->on_cancel(std::move(callback));
+}
+
+std::shared_ptr<FcgiCancelToken> FcgiRequest::cancel_token() const {
+  return _cancel_token;
+}
+
+long FcgiRequest::queued_ns() const { return _queued_ns; }
+
+void FcgiRequest::set_queued_ns(long ns) { _queued_ns = ns; }
+
+long FcgiRequest::started_ns() const { return _started_ns; }
+
+void FcgiRequest::set_started_ns(long ns) { _started_ns = ns; }
+
 bool FcgiRequest::stdout(const std::string &str) {
   const_buffers_1 buf(str.c_str(), str.size());
   return stdout(buf);
@@ -61,6 +180,41 @@ bool FcgiRequest::stdout(const_buffers_1 &buf) {
   return ret;
 }
 
+bool FcgiRequest::stdout(std::string &&str, FcgiWriteCallback callback) {
+  return stdout(std::make_shared<const std::string>(std::move(str)),
+                std::move(callback));
+}
+
+bool FcgiRequest::stdout(std::shared_ptr<const std::string> str,
+                         FcgiWriteCallback callback) {
+  const const_buffer buf(str->data(), str->size());
+  return stdout(buf, std::move(str), std::move(callback));
+}
+
+bool FcgiRequest::stdout(const const_buffer &buf,
+                         std::shared_ptr<const void> owner,
+                         FcgiWriteCallback callback) {
+  auto conn = _conn.lock();
+  bool ret = false;
+  if (conn != nullptr) {
+    ret = conn->stdout(request_id(), buf, std::move(owner),
+                       std::move(callback));
+  }
+  return ret;
+}
+
+bool FcgiRequest::stdout_file(int fd, off_t offset, size_t len,
+                              FcgiWriteCallback callback,
+                              std::shared_ptr<const void> owner) {
+  auto conn = _conn.lock();
+  bool ret = false;
+  if (conn != nullptr) {
+    ret = conn->stdout_file(request_id(), fd, offset, len, std::move(owner),
+                            std::move(callback));
+  }
+  return ret;
+}
+
 bool FcgiRequest::end_stdout() {
   auto conn = _conn.lock();
   bool ret = false;
@@ -73,7 +227,38 @@ bool FcgiRequest::reply(uint32_t code) {
   bool ret = false;
   if (conn != nullptr) {
     const bool close = !(flags() & FCGI_KEEP_CONN);
-    ret = conn->reply(request_id(), code, close);
+    ret = conn->reply(request_id(), code, FCGI_REQUEST_COMPLETE, close);
+  }
+  return ret;
+}
+
+bool FcgiRequest::reject() {
+  auto conn = _conn.lock();
+  bool ret = false;
+  if (conn != nullptr) {
+    const bool close = !(flags() & FCGI_KEEP_CONN);
+    ret = conn->reply(request_id(), 0, FCGI_OVERLOADED, close);
   }
   return ret;
 }
+
+bool FcgiRequest::writable() const {
+  auto conn = _conn.lock();
+  return conn != nullptr && conn->writable();
+}
+
+void FcgiRequest::on_writable(FcgiWriteCallback callback) {
+  auto conn = _conn.lock();
+  if (conn == nullptr) {
+    callback(false);
+    return;
+  }
+  conn->on_writable(std::move(callback));
+}
+
+bool FcgiRequest::wait_writable() {
+  auto done = std::make_shared<std::promise<bool>>();
+  auto result = done->get_future();
+  on_writable([done](bool ok) { done->set_value(ok); });
+  return result.get();
+}
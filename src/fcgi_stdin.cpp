@@ -0,0 +1,132 @@
+#include "fcgi_stdin.h"
+#include "fcgi_connection.h"
+using namespace boost::asio;
+
+static const size_t FCGI_STDIN_HIGH_WATERMARK = 1024 * 1024;
+static const size_t FCGI_STDIN_LOW_WATERMARK = 1024 * 256;
+
+FcgiStdinStream::FcgiStdinStream(std::weak_ptr<FcgiConnection> conn)
+    : _conn(conn),
+      _queued_len(0),
+      _delivering(false),
+      _ended(false),
+      _end_delivered(false),
+      _complete(false),
+      _discarded(false) {}
+
+void FcgiStdinStream::push(const const_buffer &buf) {
+  auto self = shared_from_this();
+  std::unique_lock<std::mutex> guard(_mutex);
+  if (_discarded || _ended) return;
+
+  if (_handler && !_delivering && _chunks.empty()) {
+    // nothing queued ahead of it, hand the reader's bytes over directly
+    _delivering = true;
+    guard.unlock();
+    _handler(buf, false);
+    guard.lock();
+    _delivering = false;
+    if (_discarded) _handler = nullptr;
+    deliver(guard);
+    return;
+  }
+
+  _chunks.emplace_back(buffer_cast<const char *>(buf), buffer_size(buf));
+  _queued_len += buffer_size(buf);
+  if (_handler) {
+    deliver(guard);
+  } else {
+    _cond.notify_all();
+  }
+}
+
+void FcgiStdinStream::end(bool complete) {
+  auto self = shared_from_this();
+  std::unique_lock<std::mutex> guard(_mutex);
+  _ended = true;
+  _complete = complete;
+  if (_handler) {
+    deliver(guard);
+  } else {
+    _cond.notify_all();
+  }
+}
+
+bool FcgiStdinStream::backlogged() const {
+  std::lock_guard<std::mutex> guard(_mutex);
+  return FCGI_STDIN_HIGH_WATERMARK < _queued_len;
+}
+
+void FcgiStdinStream::set_handler(FcgiStdinHandler handler) {
+  auto self = shared_from_this();
+  {
+    std::unique_lock<std::mutex> guard(_mutex);
+    _handler = std::move(handler);
+    deliver(guard);
+  }
+  resume_connection();
+}
+
+bool FcgiStdinStream::read(std::string &chunk, bool block) {
+  std::unique_lock<std::mutex> guard(_mutex);
+  while (block && _chunks.empty() && !_ended) _cond.wait(guard);
+  if (_chunks.empty()) return false;
+
+  chunk = std::move(_chunks.front());
+  _chunks.pop_front();
+  _queued_len -= chunk.size();
+  const bool resume = _queued_len <= FCGI_STDIN_LOW_WATERMARK;
+  guard.unlock();
+
+  if (resume) resume_connection();
+  return true;
+}
+
+bool FcgiStdinStream::complete() const {
+  std::lock_guard<std::mutex> guard(_mutex);
+  return _complete;
+}
+
+void FcgiStdinStream::discard() {
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    _discarded = true;
+    // a delivering thread may still be running it
+    if (!_delivering) _handler = nullptr;
+    _chunks.clear();
+    _queued_len = 0;
+  }
+  resume_connection();
+}
+
+// Runs the handler over everything queued, outside the lock.  Only one
+// thread delivers at a time so chunks keep their order.
+void FcgiStdinStream::deliver(std::unique_lock<std::mutex> &guard) {
+  if (_delivering || !_handler) return;
+
+  _delivering = true;
+  while (!_chunks.empty() && !_discarded) {
+    std::string chunk(std::move(_chunks.front()));
+    _chunks.pop_front();
+    _queued_len -= chunk.size();
+    guard.unlock();
+    _handler(buffer(chunk), false);
+    guard.lock();
+  }
+  if (_ended && !_end_delivered && !_discarded) {
+    // the handler typically frees the request, so keep it alive by moving it
+    // out before the last call
+    FcgiStdinHandler handler(std::move(_handler));
+    _end_delivered = true;
+    guard.unlock();
+    handler(const_buffer(), true);
+    guard.lock();
+  }
+  if (_discarded) _handler = nullptr;
+  _delivering = false;
+}
+
+void FcgiStdinStream::resume_connection() {
+  auto conn = _conn.lock();
+  if (conn != nullptr) conn->resume_read();
+}
@@ -0,0 +1,88 @@
+#include "fcgi_timer.h"
+#include <algorithm>
+#include "fcgi_connection.h"
+using namespace boost::asio;
+
+FcgiTimerWheel::FcgiTimerWheel(io_service &io, std::chrono::milliseconds tick,
+                               int slot_num)
+    : _timer(io),
+      _epoch(std::chrono::steady_clock::now()),
+      _tick_ms(std::max(1L, long(tick.count()))),
+      _now(0),
+      _next_tick(0),
+      _slots(slot_num) {}
+
+FcgiTimerWheel::~FcgiTimerWheel() {}
+
+void FcgiTimerWheel::start() { post_tick(); }
+
+long FcgiTimerWheel::now() const {
+  return _now.load(std::memory_order_relaxed);
+}
+
+long FcgiTimerWheel::elapsed() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - _epoch)
+      .count();
+}
+
+void FcgiTimerWheel::schedule(std::weak_ptr<FcgiConnection> conn, long when) {
+  std::lock_guard<std::mutex> guard(_mutex);
+  add(Entry{std::move(conn), when});
+}
+
+// Entries further out than one turn of the wheel sit in their slot until a
+// later turn.  Must be called under _mutex.
+void FcgiTimerWheel::add(Entry &&e) {
+  const long tick = std::max(e._when / _tick_ms, _next_tick);
+  _slots[tick % _slots.size()].push_back(std::move(e));
+}
+
+void FcgiTimerWheel::expired(FcgiTimeout timeout) {
+  _expired_nums[int(timeout)].add();
+}
+
+long FcgiTimerWheel::expired_num(FcgiTimeout timeout) const {
+  return _expired_nums[int(timeout)].load();
+}
+
+void FcgiTimerWheel::post_tick() {
+  _timer.expires_after(std::chrono::milliseconds(_tick_ms));
+  _timer.async_wait([this](const boost::system::error_code &rc) {
+    if (rc) return;
+    tick();
+    post_tick();
+  });
+}
+
+void FcgiTimerWheel::tick() {
+  const long now = elapsed();
+  _now.store(now, std::memory_order_relaxed);
+
+  std::vector<Entry> due, later;
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      if (now < _next_tick * _tick_ms) break;
+      _slots[_next_tick % _slots.size()].swap(due);
+      // what gets scheduled while the slot runs goes to the next ones
+      ++_next_tick;
+    }
+
+    for (auto &e : due) {
+      if (now < e._when) {
+        later.push_back(std::move(e));
+        continue;
+      }
+      auto conn = e._conn.lock();
+      if (conn != nullptr) conn->check_timeouts(e._when, now);
+    }
+    due.clear();
+
+    if (!later.empty()) {
+      std::lock_guard<std::mutex> guard(_mutex);
+      for (auto &e : later) add(std::move(e));
+      later.clear();
+    }
+  }
+}
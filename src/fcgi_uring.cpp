@@ -0,0 +1,305 @@
+#include "fcgi_uring.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <tuple>
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+using namespace boost::asio;
+using namespace boost::system;
+
+FcgiUring::FcgiUring(io_service &io)
+    : _io(io),
+      _event(io),
+      _event_count(0),
+      _fd(-1),
+      _sq_ring(MAP_FAILED),
+      _sq_ring_len(0),
+      _cq_ring(MAP_FAILED),
+      _cq_ring_len(0),
+      _sqes(MAP_FAILED),
+      _sqes_len(0),
+      _sq_head(nullptr),
+      _sq_tail(nullptr),
+      _sq_mask(nullptr),
+      _sq_array(nullptr),
+      _sq_flags(nullptr),
+      _sq_entries(0),
+      _cq_head(nullptr),
+      _cq_tail(nullptr),
+      _cq_mask(nullptr),
+      _cqes(nullptr),
+      _unsubmitted(0),
+      _flush_posted(false) {}
+
+#if defined(__linux__)
+FcgiUring::~FcgiUring() {
+  if (0 <= _fd) cancel_all();
+
+  error_code ec;
+  _event.close(ec);
+  if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring)
+    munmap(_cq_ring, _cq_ring_len);
+  if (_sq_ring != MAP_FAILED) munmap(_sq_ring, _sq_ring_len);
+  if (_sqes != MAP_FAILED) munmap(_sqes, _sqes_len);
+  if (0 <= _fd) ::close(_fd);
+}
+
+bool FcgiUring::open(unsigned entries) {
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  // room for the completions of a full submission queue several times over
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = entries * 4;
+  _fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (_fd < 0) return false;
+
+  _sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  _cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap)
+    _sq_ring_len = _cq_ring_len = std::max(_sq_ring_len, _cq_ring_len);
+
+  _sq_ring = mmap(nullptr, _sq_ring_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+  if (_sq_ring == MAP_FAILED) return false;
+  _cq_ring = single_mmap ? _sq_ring
+                         : mmap(nullptr, _cq_ring_len, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, _fd,
+                                IORING_OFF_CQ_RING);
+  if (_cq_ring == MAP_FAILED) return false;
+  _sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+  _sqes = mmap(nullptr, _sqes_len, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+  if (_sqes == MAP_FAILED) return false;
+
+  char *sq = (char *)_sq_ring;
+  _sq_head = (unsigned *)(sq + p.sq_off.head);
+  _sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  _sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  _sq_array = (unsigned *)(sq + p.sq_off.array);
+  _sq_flags = (unsigned *)(sq + p.sq_off.flags);
+  _sq_entries = p.sq_entries;
+  char *cq = (char *)_cq_ring;
+  _cq_head = (unsigned *)(cq + p.cq_off.head);
+  _cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  _cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  _cqes = cq + p.cq_off.cqes;
+
+  int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd < 0) return false;
+  if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_EVENTFD, &event_fd,
+              1) != 0) {
+    ::close(event_fd);
+    return false;
+  }
+  _event.assign(event_fd);
+  post_wait();
+  return true;
+}
+
+void FcgiUring::recv(int fd, void *buf, unsigned len,
+                     FcgiUringCompletion completion) {
+  queue(IORING_OP_RECV, fd, (uint64_t)buf, len, 0, 0, std::move(completion));
+}
+
+void FcgiUring::sendmsg(int fd, const msghdr *msg,
+                        FcgiUringCompletion completion) {
+  queue(IORING_OP_SENDMSG, fd, (uint64_t)msg, 1, MSG_NOSIGNAL, 0,
+        std::move(completion));
+}
+
+void FcgiUring::poll(int fd, unsigned events, FcgiUringCompletion completion) {
+  queue(IORING_OP_POLL_ADD, fd, 0, 0, events, 0, std::move(completion));
+}
+
+void FcgiUring::accept(int fd, FcgiUringCompletion completion) {
+  queue(IORING_OP_ACCEPT, fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC,
+        IORING_ACCEPT_MULTISHOT, std::move(completion));
+}
+
+bool FcgiUring::more(unsigned flags) { return flags & IORING_CQE_F_MORE; }
+
+long FcgiUring::enter_num() const { return _enter_num.load(); }
+
+long FcgiUring::submit_num() const { return _submit_num.load(); }
+
+long FcgiUring::complete_num() const { return _complete_num.load(); }
+
+void FcgiUring::queue(uint8_t opcode, int fd, uint64_t addr, unsigned len,
+                      uint32_t op_flags, uint16_t ioprio,
+                      FcgiUringCompletion completion) {
+  std::unique_lock<std::mutex> guard(_mutex);
+  auto sqe = (io_uring_sqe *)get_sqe();
+  if (sqe == nullptr) {
+    guard.unlock();
+    post(_io, [completion]() { completion(-EBUSY, 0); });
+    return;
+  }
+
+  auto op = new Op{std::move(completion)};
+  _pending.insert(op);
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = addr;
+  sqe->len = len;
+  sqe->rw_flags = op_flags;
+  sqe->ioprio = ioprio;
+  sqe->user_data = (uint64_t)op;
+  post_flush();
+}
+
+// Takes the next free entry of the submission queue, submitting what is
+// queued first if it is full.  Must be called under _mutex.
+void *FcgiUring::get_sqe() {
+  const unsigned tail = *_sq_tail;
+  if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) == _sq_entries) {
+    const int n = enter(_unsubmitted, 0, 0);
+    if (0 < n) _unsubmitted -= n;
+    if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) == _sq_entries)
+      return nullptr;
+  }
+
+  const unsigned idx = tail & *_sq_mask;
+  auto sqe = (io_uring_sqe *)_sqes + idx;
+  memset(sqe, 0, sizeof(*sqe));
+  _sq_array[idx] = idx;
+  __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++_unsubmitted;
+  return sqe;
+}
+
+int FcgiUring::enter(unsigned to_submit, unsigned min_complete,
+                     unsigned flags) {
+  _enter_num.add();
+  const int n = syscall(__NR_io_uring_enter, _fd, to_submit, min_complete,
+                        flags, nullptr, 0);
+  if (0 < n) _submit_num.add(n);
+  return n;
+}
+
+void FcgiUring::post_flush() {
+  if (_flush_posted) return;
+  _flush_posted = true;
+  post(_io, [this]() { flush(); });
+}
+
+void FcgiUring::flush() {
+  std::lock_guard<std::mutex> guard(_mutex);
+  _flush_posted = false;
+  if (_unsubmitted == 0) return;
+  const int n = enter(_unsubmitted, 0, 0);
+  if (0 < n) _unsubmitted -= n;
+}
+
+void FcgiUring::post_wait() {
+  _event.async_read_some(buffer(&_event_count, sizeof(_event_count)),
+                         [this](const error_code &rc, size_t) {
+                           if (rc) return;
+                           reap();
+                           post_wait();
+                         });
+}
+
+void FcgiUring::reap() {
+  std::vector<std::tuple<Op *, int, unsigned>> done;
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    // completions the queue had no room for are flushed by entering
+    if (__atomic_load_n(_sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)
+      enter(0, 0, IORING_ENTER_GETEVENTS);
+
+    unsigned head = *_cq_head;
+    const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      auto cqe = (io_uring_cqe *)_cqes + (head & *_cq_mask);
+      if (cqe->user_data != 0)
+        done.emplace_back((Op *)cqe->user_data, cqe->res, cqe->flags);
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+  }
+  _complete_num.add(done.size());
+
+  for (auto &d : done) {
+    Op *op = std::get<0>(d);
+    const unsigned flags = std::get<2>(d);
+    op->_completion(std::get<1>(d), flags);
+    if (!(flags & IORING_CQE_F_MORE)) {
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _pending.erase(op);
+      }
+      delete op;
+    }
+  }
+  // whatever the handlers queued goes out right away
+  flush();
+}
+
+// Cancels every operation still in flight and waits for the kernel to let
+// go of it, so that no buffer is written after its owner has gone.  The
+// completions are dropped without being invoked.
+void FcgiUring::cancel_all() {
+  std::vector<Op *> done;
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    bool cancelled = true;
+    for (auto op : _pending) {
+      auto sqe = (io_uring_sqe *)get_sqe();
+      if (sqe == nullptr) {
+        cancelled = false;
+        break;
+      }
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t)op;
+    }
+
+    while (cancelled && !_pending.empty()) {
+      const int n = enter(_unsubmitted, 1, IORING_ENTER_GETEVENTS);
+      if (n < 0 && errno != EINTR) break;
+      if (0 < n) _unsubmitted -= n;
+
+      unsigned head = *_cq_head;
+      const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; ++head) {
+        auto cqe = (io_uring_cqe *)_cqes + (head & *_cq_mask);
+        auto op = (Op *)cqe->user_data;
+        if (op != nullptr && !(cqe->flags & IORING_CQE_F_MORE) &&
+            _pending.erase(op) != 0)
+          done.push_back(op);
+      }
+      __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    }
+    done.insert(done.end(), _pending.begin(), _pending.end());
+    _pending.clear();
+  }
+  for (auto op : done) delete op;
+}
+
+#else
+FcgiUring::~FcgiUring() {}
+
+bool FcgiUring::open(unsigned) { return false; }
+
+void FcgiUring::recv(int, void *, unsigned, FcgiUringCompletion) {}
+
+void FcgiUring::sendmsg(int, const msghdr *, FcgiUringCompletion) {}
+
+void FcgiUring::poll(int, unsigned, FcgiUringCompletion) {}
+
+void FcgiUring::accept(int, FcgiUringCompletion) {}
+
+bool FcgiUring::more(unsigned) { return false; }
+
+long FcgiUring::enter_num() const { return 0; }
+
+long FcgiUring::submit_num() const { return 0; }
+
+long FcgiUring::complete_num() const { return 0; }
+#endif